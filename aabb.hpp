@@ -41,6 +41,38 @@ public:
         return true;
     }
 
+    /**
+     * @brief Slab test that also narrows the ray interval to the box
+     *
+     * @param t_min Set to the parameter where the ray enters the box
+     * @param t_max Set to the parameter where the ray leaves the box
+     * @return true if the ray overlaps the box within [t_min, t_max]
+     */
+    inline bool clip(const ray& ray, double& t_min, double& t_max) const {
+        for (int i = 0; i < 3; ++i) {
+            auto inverseDirection = 1.0 / ray.direction()[i];
+            auto t0 = (_min[i] - ray.origin()[i]) * inverseDirection;
+            auto t1 = (_max[i] - ray.origin()[i]) * inverseDirection;
+
+            if (inverseDirection < 0.0) {
+                std::swap(t0, t1);
+            }
+
+            t_min = fmax(t0, t_min);
+            t_max = fmin(t1, t_max);
+            if (t_max < t_min) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    double surface_area() const {
+        auto extent = _max - _min;
+        return 2 * (extent.x() * extent.y() + extent.y() * extent.z() +
+                    extent.z() * extent.x());
+    }
+
 public:
     point3 _min;
     point3 _max;
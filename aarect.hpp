@@ -15,27 +15,33 @@ public:
             std::shared_ptr<material> mat)
         : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat){};
 
-    virtual bool hit(const ray& r, double t0, double t1,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double t0, double t1,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
 
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension so pad
         // the Z-dimension a small amount
         output_box =
-            aabb{point3{x0, y0, k - EPSILON}, point3{x1, y1, k + EPSILON}};
+            aabb(point3(x0, y0, k - EPSILON), point3(x1, y1, k + EPSILON));
         return true;
     }
 
 public:
     std::shared_ptr<material> mp;
-    double x0, x1, y0, y1, k;
+    // Rounded to `real` once, so a hit snapped onto the plane at k is exactly
+    // on the plane that rays leaving it are tested against
+    real x0, x1, y0, y1, k;
 };
 
-bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+bool xy_rect::intersect(const ray& r, double t0, double t1,
+                        hit_query& query) const {
     auto t = (k - r.origin().z()) / r.direction().z();
 
-    if (t < t0 || t > t1) {
+    if (!(t > t0 && t < t1)) {
         return false;
     }
 
@@ -45,16 +51,27 @@ bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
         return false;
     }
 
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
-    rec.t = t;
+    query.u = (x - x0) / (x1 - x0);
+    query.v = (y - y0) / (y1 - y0);
+    query.t = t;
+    query.object = this;
+
+    return true;
+}
+
+void xy_rect::shade(const ray& r, const hit_query& query,
+                    hit_record& rec) const {
+    rec.u = query.u;
+    rec.v = query.v;
+    rec.t = query.t;
 
     auto outward_normal = vec3{0, 0, 1};
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
+    rec.p[2] = k;
+    // Exactly on the plane, where rays leaving it find t = 0 and miss it
+    rec.error_offset = vec3{0, 0, 0};
 }
 
 // X, Z
@@ -66,40 +83,55 @@ public:
             std::shared_ptr<material> mat)
         : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat){};
 
-    virtual bool hit(const ray& r, double t0, double t1,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double t0, double t1,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
 
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension so pad
         // the Y-dimension a small amount
         output_box =
-            aabb(point3{x0, k - EPSILON, z0}, point3{x1, k + EPSILON, z1});
+            aabb(point3(x0, k - EPSILON, z0), point3(x1, k + EPSILON, z1));
         return true;
     }
 
 public:
     std::shared_ptr<material> mp;
-    double x0, x1, z0, z1, k;
+    real x0, x1, z0, z1, k; // Rounded as xy_rect's are
 };
 
 
-bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+bool xz_rect::intersect(const ray& r, double t0, double t1,
+                        hit_query& query) const {
     auto t = (k - r.origin().y()) / r.direction().y();
-    if (t < t0 || t > t1)
+    if (!(t > t0 && t < t1))
         return false;
     auto x = r.origin().x() + t * r.direction().x();
     auto z = r.origin().z() + t * r.direction().z();
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
-    rec.t = t;
+    query.u = (x - x0) / (x1 - x0);
+    query.v = (z - z0) / (z1 - z0);
+    query.t = t;
+    query.object = this;
+    return true;
+}
+
+void xz_rect::shade(const ray& r, const hit_query& query,
+                    hit_record& rec) const {
+    rec.u = query.u;
+    rec.v = query.v;
+    rec.t = query.t;
     auto outward_normal = vec3{0, 1, 0};
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
+    rec.p[1] = k;
+    // Exactly on the plane, where rays leaving it find t = 0 and miss it
+    rec.error_offset = vec3{0, 0, 0};
 }
 
 // class yz_rect : public hittable {
@@ -135,40 +167,55 @@ public:
             std::shared_ptr<material> mat)
         : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat){};
 
-    virtual bool hit(const ray& r, double t0, double t1,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double t0, double t1,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
 
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension so pad
         // the X-dimension a small amount
         output_box =
-            aabb{point3{k - EPSILON, y0, z0}, point3{k + EPSILON, y1, z1}};
+            aabb(point3(k - EPSILON, y0, z0), point3(k + EPSILON, y1, z1));
         return true;
     }
 
 public:
     std::shared_ptr<material> mp;
-    double y0, y1, z0, z1, k;
+    real y0, y1, z0, z1, k; // Rounded as xy_rect's are
 };
 
 
-bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+bool yz_rect::intersect(const ray& r, double t0, double t1,
+                        hit_query& query) const {
     auto t = (k - r.origin().x()) / r.direction().x();
-    if (t < t0 || t > t1)
+    if (!(t > t0 && t < t1))
         return false;
     auto y = r.origin().y() + t * r.direction().y();
     auto z = r.origin().z() + t * r.direction().z();
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
-    rec.t = t;
+    query.u = (y - y0) / (y1 - y0);
+    query.v = (z - z0) / (z1 - z0);
+    query.t = t;
+    query.object = this;
+    return true;
+}
+
+void yz_rect::shade(const ray& r, const hit_query& query,
+                    hit_record& rec) const {
+    rec.u = query.u;
+    rec.v = query.v;
+    rec.t = query.t;
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
+    rec.p[0] = k;
+    // Exactly on the plane, where rays leaving it find t = 0 and miss it
+    rec.error_offset = vec3{0, 0, 0};
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,488 @@
+/**
+ * @file bidirectional.hpp
+ * @author @rjkilpatrick
+ * @brief Bidirectional path tracing, for light that paths from the camera
+ * rarely find
+ *
+ * Follows Veach's thesis, as laid out in Pharr, Jakob and Humphreys,
+ * "Physically Based Rendering" 3rd ed., 16.3. Each camera sample also
+ * follows a path out from a light picked by its power, and every vertex of
+ * one path is joined to every vertex of the other. Each joined path is
+ * weighted by the power heuristic against all the other ways the same path
+ * could have been made. A light behind glass, which a shadow ray can never
+ * reach, is then found by light paths refracting out through the glass and
+ * landing where the camera's paths can join them. Joining a light path
+ * straight to the camera lands on whichever pixel it projects to, so that
+ * light is splatted into a film whose adds are atomic. Only a pinhole
+ * camera can be joined to, mirrors and glass cannot be joined through, and
+ * emitters the light list does not sample are only found by camera paths.
+ *
+ */
+#ifndef BIDIRECTIONAL_H
+#define BIDIRECTIONAL_H
+
+#include "camera.hpp"
+#include "environment.hpp"
+#include "hittable.hpp"
+#include "lights.hpp"
+#include "material.hpp"
+#include "material_table.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Light landing on pixels other than the one being sampled, which
+ * any thread can add to
+ */
+class splat_film {
+public:
+    splat_film(int width, int height);
+
+    void add(int i, int j, const colour3& c);
+
+    // Adds the splats to an image of summed samples, which `write_colour`
+    // then divides by the samples per pixel
+    void add_to(std::vector<colour3>& image) const;
+
+public:
+    int width, height;
+    std::vector<std::atomic<double>> values; // Red, green, blue per pixel
+};
+
+splat_film::splat_film(int width, int height)
+    : width(width), height(height), values(3 * size_t(width) * height) {
+    for (auto& v : values) {
+        v.store(0, std::memory_order_relaxed);
+    }
+}
+
+void splat_film::add(int i, int j, const colour3& c) {
+    auto* pixel = &values[3 * (size_t(j) * width + i)];
+    for (int k = 0; k < 3; ++k) {
+        atomic_add(pixel[k], double(c[k]));
+    }
+}
+
+void splat_film::add_to(std::vector<colour3>& image) const {
+    for (size_t p = 0; p < image.size(); ++p) {
+        image[p] += colour3(values[3 * p].load(std::memory_order_relaxed),
+                            values[3 * p + 1].load(std::memory_order_relaxed),
+                            values[3 * p + 2].load(std::memory_order_relaxed));
+    }
+}
+
+namespace bidirectional_detail {
+
+struct vertex {
+    enum class kind { camera, light, surface };
+
+    kind type = kind::surface;
+    point3 p;
+    vec3 normal;    // Of a light, or of a surface facing its incoming ray
+    hit_record rec; // Surfaces
+    ray incoming;   // Surfaces: the ray that reached them
+    bool two_sided = false; // Lights
+    colour3 beta;           // Light or importance carried here, over its
+                            // density
+    // Per unit area of reaching here from the vertex before, and of the
+    // other path reaching here from the vertex after
+    double pdf_forward = 0;
+    double pdf_reverse = 0;
+    bool delta = false; // Scattered into a single direction, or a lens
+
+    // Whether a path can be joined to this vertex
+    bool connectible() const {
+        return type != kind::surface || rec.mat_ptr->samples_lights();
+    }
+};
+
+// Converts a density per unit solid angle at from into one per unit area at
+// to
+inline double to_area(double pdf, const point3& from, const vertex& to) {
+    auto d = to.p - from;
+    auto distance_squared = d.length_squared();
+    if (!(distance_squared > 0)) {
+        return 0;
+    }
+    if (to.type != vertex::kind::camera) {
+        pdf *= std::fabs(dot(to.normal, d)) / std::sqrt(distance_squared);
+    }
+    return pdf / distance_squared;
+}
+
+} // namespace bidirectional_detail
+
+class bidirectional_tracer {
+public:
+    bidirectional_tracer(const hittable& world, const light_list& lights,
+                         const material_table& materials, const camera& cam,
+                         const environment& background, splat_film& film,
+                         int max_bounces);
+
+    /**
+     * @brief Light arriving at the camera along r, which `cam` made for this
+     * tracer's film
+     *
+     * Light the sample's light path sends to other pixels is splatted into
+     * the film. A tracer keeps its paths between calls, so each thread needs
+     * its own.
+     */
+    colour3 sample(const ray& r);
+
+private:
+    using vertex = bidirectional_detail::vertex;
+
+    // Extends path along r until it leaves the scene, is absorbed or has
+    // max_vertices, returning the light it escapes to
+    colour3 walk(ray r, colour3 beta, double pdf, std::vector<vertex>& path,
+                 size_t max_vertices) const;
+
+    // Light carried by the path of s light and t camera vertices, or black
+    // if they cannot be joined. Joining to the camera sets the pixel hit.
+    colour3 connect(int s, int t, double time, int& i, int& j) const;
+
+    // Weight of the path of s light and t camera vertices
+    double weight(int s, int t) const;
+
+    // Per unit area at next, of v scattering towards it after previous
+    double pdf(const vertex* previous, const vertex& v,
+               const vertex& next) const;
+
+    // Per unit solid angle, of a camera ray leaving along the unit direction
+    double camera_pdf(const vec3& direction) const;
+
+    // Light or importance v sends along the unit direction, times the
+    // cosine to its normal
+    colour3 scattered(const vertex& v, const vec3& direction) const;
+
+    bool visible(const vertex& a, const vertex& b, double time) const;
+
+    const hittable& world;
+    const light_list& lights;
+    const material_table& materials;
+    const camera& cam;
+    const environment& background;
+    splat_film& film;
+    int max_bounces;
+    double film_area; // Of the pixels, scaled to a unit distance
+
+    std::vector<vertex> camera_path, light_path;
+};
+
+bidirectional_tracer::bidirectional_tracer(
+    const hittable& world, const light_list& lights,
+    const material_table& materials, const camera& cam,
+    const environment& background, splat_film& film, int max_bounces)
+    : world(world), lights(lights), materials(materials), cam(cam),
+      background(background), film(film), max_bounces(max_bounces) {
+    // Pixels span [0, width / (width - 1)) in get_ray's s, and likewise t
+    film_area = cam.screen_area() * film.width / (film.width - 1.0) *
+                film.height / (film.height - 1.0);
+}
+
+colour3 bidirectional_tracer::sample(const ray& r) {
+    camera_path.clear();
+    light_path.clear();
+
+    vertex lens;
+    lens.type = vertex::kind::camera;
+    lens.p = r.origin();
+    lens.normal = cam.forward();
+    lens.beta = colour3(1, 1, 1);
+    lens.delta = !cam.is_pinhole();
+    camera_path.push_back(lens);
+    auto escaped =
+        walk(r, lens.beta, camera_pdf(unit_vector(r.direction())),
+             camera_path, max_bounces + 1);
+
+    emission_sample e;
+    if (lights.sample_emission(e)) {
+        vertex light;
+        light.type = vertex::kind::light;
+        light.p = e.p;
+        light.normal = e.normal;
+        light.two_sided = e.two_sided;
+        light.beta = e.emitted / e.pdf_position;
+        light.pdf_forward = e.pdf_position;
+        light_path.push_back(light);
+        // Nudged off the light, which has no bound on its rounding error
+        auto beta =
+            light.beta * (std::fabs(dot(e.normal, e.direction)) /
+                          e.pdf_direction);
+        walk(ray(e.p + EPSILON * e.direction, e.direction, r.time()), beta,
+             e.pdf_direction, light_path, max_bounces);
+    }
+
+    auto colour = escaped;
+    for (int t = 1; t <= int(camera_path.size()); ++t) {
+        for (int s = 0; s <= int(light_path.size()); ++s) {
+            auto bounces = s + t - 2;
+            // A light seen straight from the camera is left to the camera's
+            // path, which lands on the right pixel
+            if ((t == 1 && s <= 1) || bounces > max_bounces) {
+                continue;
+            }
+            int i = 0, j = 0;
+            auto c = connect(s, t, r.time(), i, j);
+            if (c.x() + c.y() + c.z() <= 0) {
+                continue;
+            }
+            c *= weight(s, t);
+            if (t == 1) {
+                film.add(i, j, c);
+            } else {
+                colour += c;
+            }
+        }
+    }
+    return colour;
+}
+
+colour3 bidirectional_tracer::walk(ray r, colour3 beta, double pdf,
+                                   std::vector<vertex>& path,
+                                   size_t max_vertices) const {
+    while (path.size() < max_vertices) {
+        hit_record rec;
+        if (!world.hit(r, 0, infinity, rec)) {
+            // Only camera paths see the environment
+            if (path[0].type == vertex::kind::camera) {
+                return beta * background.value(r.direction());
+            }
+            break;
+        }
+
+        vertex v;
+        v.p = rec.p;
+        v.normal = rec.normal;
+        v.rec = rec;
+        v.incoming = r;
+        v.beta = beta;
+        v.pdf_forward = bidirectional_detail::to_area(pdf, path.back().p, v);
+        path.push_back(v);
+
+        colour3 attenuation;
+        ray out;
+        if (path.size() == max_vertices ||
+            !materials.scatter(r, rec, attenuation, out)) {
+            break;
+        }
+
+        // Mirrors and glass have no density to weight by
+        auto direction = unit_vector(out.direction());
+        double reverse = 0;
+        if (rec.mat_ptr->samples_lights()) {
+            pdf = rec.mat_ptr->scattering_pdf(r, rec, direction);
+            reverse = rec.mat_ptr->scattering_pdf(
+                ray(out.origin(), -direction, r.time()), rec,
+                -unit_vector(r.direction()));
+            if (!(pdf > 0)) {
+                break;
+            }
+        } else {
+            path.back().delta = true;
+            pdf = 0;
+        }
+        auto& previous = path[path.size() - 2];
+        previous.pdf_reverse =
+            bidirectional_detail::to_area(reverse, rec.p, previous);
+
+        beta = beta * attenuation;
+        r = out;
+    }
+    return colour3(0, 0, 0);
+}
+
+colour3 bidirectional_tracer::connect(int s, int t, double time, int& i,
+                                      int& j) const {
+    const auto& pt = camera_path[t - 1];
+    if (s == 0) {
+        // The camera's path found a light itself
+        const auto& rec = pt.rec;
+        return pt.beta * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    }
+
+    const auto& qs = light_path[s - 1];
+    if (!qs.connectible() || !pt.connectible() ||
+        (t == 1 && !cam.is_pinhole())) {
+        return colour3(0, 0, 0);
+    }
+
+    auto join = pt.p - qs.p;
+    auto distance_squared = join.length_squared();
+    if (!(distance_squared > 0)) {
+        return colour3(0, 0, 0);
+    }
+    auto direction = join / std::sqrt(distance_squared);
+
+    colour3 c;
+    if (t == 1) {
+        // Lands on whichever pixel qs projects to
+        double screen_s, screen_t;
+        if (!cam.screen_position(qs.p, screen_s, screen_t)) {
+            return colour3(0, 0, 0);
+        }
+        i = static_cast<int>(std::floor(screen_s * (film.width - 1)));
+        j = static_cast<int>(std::floor(screen_t * (film.height - 1)));
+        if (i < 0 || i >= film.width || j < 0 || j >= film.height) {
+            return colour3(0, 0, 0);
+        }
+        // The camera's importance, times the cosine at the lens
+        c = qs.beta * scattered(qs, direction) *
+            (camera_pdf(-direction) / distance_squared);
+    } else {
+        c = qs.beta * scattered(qs, direction) * pt.beta *
+            scattered(pt, -direction) / distance_squared;
+    }
+
+    if (c.x() + c.y() + c.z() <= 0 || !visible(qs, pt, time)) {
+        return colour3(0, 0, 0);
+    }
+    return c;
+}
+
+double bidirectional_tracer::weight(int s, int t) const {
+    if (s + t == 2) {
+        return 1;
+    }
+
+    // The vertices at either side of the join, and those before them
+    const auto& pt = camera_path[t - 1];
+    const vertex* qs = s > 0 ? &light_path[s - 1] : nullptr;
+    const vertex* pt_minus = t > 1 ? &camera_path[t - 2] : nullptr;
+    const vertex* qs_minus = s > 1 ? &light_path[s - 2] : nullptr;
+
+    // Densities with which the other path would have reached each of them,
+    // which only this join decides
+    double pt_reverse, pt_minus_reverse = 0, qs_reverse = 0,
+                       qs_minus_reverse = 0;
+    if (s > 0) {
+        pt_reverse = pdf(qs_minus, *qs, pt);
+    } else {
+        pt_reverse = lights.emission_pdf_position(pt.rec.mat_ptr, pt.p);
+        // Only a camera path can find a light that is not sampled
+        if (!(pt_reverse > 0)) {
+            return 1;
+        }
+    }
+    if (pt_minus) {
+        if (s > 0) {
+            pt_minus_reverse = pdf(qs, pt, *pt_minus);
+        } else {
+            auto direction = unit_vector(pt_minus->p - pt.p);
+            pt_minus_reverse = bidirectional_detail::to_area(
+                lights.emission_pdf_direction(pt.rec.mat_ptr, pt.p,
+                                              direction),
+                pt.p, *pt_minus);
+        }
+    }
+    if (qs) {
+        qs_reverse = pdf(pt_minus, pt, *qs);
+    }
+    if (qs_minus) {
+        qs_minus_reverse = pdf(&pt, *qs, *qs_minus);
+    }
+
+    // Sums the squared ratio of each other way's density to this one's,
+    // moving the join a vertex at a time. Zero densities belong to delta
+    // vertices, which cancel.
+    auto nonzero = [](double pdf) { return pdf != 0 ? pdf : 1; };
+    double sum = 0;
+    double ratio = 1;
+    for (int i = t - 1; i > 0; --i) {
+        const auto& v = camera_path[i];
+        auto reverse = i == t - 1   ? pt_reverse
+                       : i == t - 2 ? pt_minus_reverse
+                                    : v.pdf_reverse;
+        ratio *= nonzero(reverse) / nonzero(v.pdf_forward);
+        auto delta = i != t - 1 && v.delta;
+        if (!delta && !camera_path[i - 1].delta) {
+            sum += ratio * ratio;
+        }
+    }
+    ratio = 1;
+    for (int i = s - 1; i >= 0; --i) {
+        const auto& v = light_path[i];
+        auto reverse = i == s - 1   ? qs_reverse
+                       : i == s - 2 ? qs_minus_reverse
+                                    : v.pdf_reverse;
+        ratio *= nonzero(reverse) / nonzero(v.pdf_forward);
+        auto delta = i != s - 1 && v.delta;
+        if (!delta && !(i > 0 && light_path[i - 1].delta)) {
+            sum += ratio * ratio;
+        }
+    }
+    return 1 / (1 + sum);
+}
+
+double bidirectional_tracer::pdf(const vertex* previous, const vertex& v,
+                                 const vertex& next) const {
+    auto direction = unit_vector(next.p - v.p);
+    double solid_angle = 0;
+    switch (v.type) {
+    case vertex::kind::camera:
+        solid_angle = camera_pdf(direction);
+        break;
+    case vertex::kind::light: {
+        auto cosine = dot(v.normal, direction);
+        solid_angle = v.two_sided ? std::fabs(cosine) / (2 * M_PI)
+                                  : std::fmax(0.0, cosine) / M_PI;
+        break;
+    }
+    case vertex::kind::surface:
+        solid_angle = v.rec.mat_ptr->scattering_pdf(
+            ray(previous->p, v.p - previous->p, v.incoming.time()), v.rec,
+            direction);
+        break;
+    }
+    return bidirectional_detail::to_area(solid_angle, v.p, next);
+}
+
+double bidirectional_tracer::camera_pdf(const vec3& direction) const {
+    auto cosine = dot(direction, cam.forward());
+    double s, t;
+    if (cosine <= 0 ||
+        !cam.screen_position(cam.position() + direction, s, t) || s < 0 ||
+        t < 0 || s * (film.width - 1) >= film.width ||
+        t * (film.height - 1) >= film.height) {
+        return 0;
+    }
+    // Uniform over the screen, as get_ray picks it
+    return 1 / (film_area * cosine * cosine * cosine);
+}
+
+colour3 bidirectional_tracer::scattered(const vertex& v,
+                                        const vec3& direction) const {
+    if (v.type == vertex::kind::light) {
+        auto cosine = dot(v.normal, direction);
+        cosine = v.two_sided ? std::fabs(cosine) : std::fmax(0.0, cosine);
+        return colour3(cosine, cosine, cosine);
+    }
+    // Lambertian and microfacet reflection are symmetric, so serve light
+    // and camera paths alike
+    return v.rec.mat_ptr->eval(v.incoming, v.rec, direction);
+}
+
+bool bidirectional_tracer::visible(const vertex& a, const vertex& b,
+                                   double time) const {
+    auto from =
+        a.type == vertex::kind::surface ? offset_ray_origin(a.rec, b.p - a.p)
+                                        : a.p;
+    auto to = b.type == vertex::kind::surface
+                  ? offset_ray_origin(b.rec, from - b.p)
+                  : b.p;
+    auto d = to - from;
+    auto distance = d.length();
+    if (!(distance > EPSILON)) {
+        return true;
+    }
+    // Stops just short of b, so a light does not shadow itself
+    hit_query query;
+    return !world.intersect(ray(from, d, time), 0, 1 - EPSILON / distance,
+                            query);
+}
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * @file box.hpp
+ * @author @rjkilpatrick
+ * @brief Solid axis-aligned box
+ *
+ * One slab test finds both where the ray enters and where it leaves the box,
+ * along with the face it crosses at each, so a box costs a single
+ * intersection rather than one for each of six rectangles.
+ *
+ */
+#ifndef BOX_H
+#define BOX_H
+
+#include "hittable.hpp"
+#include "utils.hpp"
+
+#include <memory>
+
+class box : public hittable {
+public:
+    box() {}
+    box(const point3& p0, const point3& p1, std::shared_ptr<material> m)
+        : box_min(fmin(p0, p1)), box_max(fmax(p0, p1)), mat_ptr(m) {}
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override {
+        output_box = aabb(box_min, box_max);
+        return true;
+    }
+
+public:
+    point3 box_min;
+    point3 box_max;
+    std::shared_ptr<material> mat_ptr;
+};
+
+// The face hit is recorded as its axis, plus 3 for the face on the maximum
+// side
+bool box::intersect(const ray& r, double t_min, double t_max,
+                    hit_query& query) const {
+    double t_enter = -infinity;
+    double t_exit = infinity;
+    int enter_face = 0;
+    int exit_face = 0;
+
+    for (int i = 0; i < 3; ++i) {
+        auto inverse_direction = 1.0 / r.direction()[i];
+        auto t0 = (box_min[i] - r.origin()[i]) * inverse_direction;
+        auto t1 = (box_max[i] - r.origin()[i]) * inverse_direction;
+        auto near_face = i;
+        auto far_face = i + 3;
+        if (inverse_direction < 0.0) {
+            std::swap(t0, t1);
+            std::swap(near_face, far_face);
+        }
+
+        if (t0 > t_enter) {
+            t_enter = t0;
+            enter_face = near_face;
+        }
+        if (t1 < t_exit) {
+            t_exit = t1;
+            exit_face = far_face;
+        }
+    }
+    if (!(t_enter <= t_exit)) {
+        return false;
+    }
+
+    // Rays starting inside the box hit it on the way out
+    if (t_enter > t_min && t_enter < t_max) {
+        query.t = t_enter;
+        query.primitive = static_cast<uint32_t>(enter_face);
+    } else if (t_exit > t_min && t_exit < t_max) {
+        query.t = t_exit;
+        query.primitive = static_cast<uint32_t>(exit_face);
+    } else {
+        return false;
+    }
+    query.object = this;
+    return true;
+}
+
+void box::shade(const ray& r, const hit_query& query, hit_record& rec) const {
+    int axis = query.primitive % 3;
+    bool max_side = query.primitive >= 3;
+    // Face co-ordinates run along the same axes as the matching aarect's
+    int u_axis = axis == 0 ? 1 : 0;
+    int v_axis = axis == 2 ? 1 : 2;
+
+    rec.t = query.t;
+    rec.p = r.at(rec.t);
+    rec.p[axis] = max_side ? box_max[axis] : box_min[axis];
+    // Exactly on the face, where rays leaving it find t = 0 and miss it
+    rec.error_offset = vec3{0, 0, 0};
+    rec.u = (rec.p[u_axis] - box_min[u_axis]) /
+            (box_max[u_axis] - box_min[u_axis]);
+    rec.v = (rec.p[v_axis] - box_min[v_axis]) /
+            (box_max[v_axis] - box_min[v_axis]);
+
+    vec3 outward_normal{0, 0, 0};
+    outward_normal[axis] = max_side ? 1 : -1;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mat_ptr.get();
+}
+
+#endif
@@ -8,12 +8,35 @@
  */
 
 #ifndef BVH_H
-#define BHV_H
+#define BVH_H
 
 #include "hittable_list.hpp"
 #include "utils.hpp"
 
 #include <algorithm>
+#include <iostream>
+
+inline bool box_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b, int axis) {
+    aabb box_a;
+    aabb box_b;
+
+    if (!(a->bounding_box(0, 0, box_a) && b->bounding_box(0, 0, box_b))) {
+        std::cerr << "No bounding box in bvh_node constructor.\n";
+    }
+    return box_a.min().e[axis] < box_b.min().e[axis];
+}
+
+bool box_x_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
+    return box_compare(a, b, 0);
+}
+
+bool box_y_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
+    return box_compare(a, b, 1);
+}
+
+bool box_z_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
+    return box_compare(a, b, 2);
+}
 
 class bvh_node : public hittable {
 public:
@@ -26,8 +49,12 @@ public:
     bvh_node(std::vector<std::shared_ptr<hittable>>& objects, size_t start,
              size_t end, double time0, double time1);
 
-    virtual bool hit(const ray& ray, double t_min, double t_max,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& ray, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    // Hits name the leaf object that was hit, which shades them itself
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {}
 
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override;
@@ -43,14 +70,15 @@ bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const {
     return true;
 }
 
-bool bvh_node::hit(const ray& ray, double t_min, double t_max,
-                   hit_record& rec) const {
+bool bvh_node::intersect(const ray& ray, double t_min, double t_max,
+                         hit_query& query) const {
     if (!box.hit(ray, t_min, t_max)) {
         return false;
     }
 
-    bool hit_left = left->hit(ray, t_min, t_max, rec);
-    bool hit_right = right->hit(ray, t_min, hit_left ? rec.t : t_max, rec);
+    bool hit_left = left->intersect(ray, t_min, t_max, query);
+    bool hit_right =
+        right->intersect(ray, t_min, hit_left ? query.t : t_max, query);
 
     return hit_left || hit_right;
 }
@@ -65,7 +93,7 @@ bvh_node::bvh_node(std::vector<std::shared_ptr<hittable>>& objects,
 
     if (object_span == 1) {
         left = right = objects[start];
-    } else if (object_span = 2) {
+    } else if (object_span == 2) {
         if (comparator(objects[start], objects[start + 1])) {
             left = objects[start];
             right = objects[start + 1];
@@ -90,26 +118,4 @@ bvh_node::bvh_node(std::vector<std::shared_ptr<hittable>>& objects,
     box = surrounding_box(box_left, box_right);
 }
 
-inline bool box_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b, int axis) {
-    aabb box_a;
-    aabb box_b;
-
-    if (!(a->bounding_box(0, 0, box_a) && b->bounding_box(0, 0, box_b))) {
-        std::cerr << "No bounding box in bvh_node constructor.\n";
-    }
-    return box_a.min().e[axis] < box_b.min().e[axis];
-}
-
-bool box_x_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
-    return box_compare(a, b, 0);
-}
-
-bool box_y_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
-    return box_compare(a, b, 1);
-}
-
-bool box_z_compare (const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
-    return box_compare(a, b, 2);
-}
-
 #endif
\ No newline at end of file
@@ -44,7 +44,60 @@ public:
                    random_double(t_open, t_close)};
     }
 
+    // Bounds every ray get_ray can return for s in [s0, s1], t in [t0, t1]
+    ray_bundle get_ray_bundle(double s0, double s1, double t0,
+                              double t1) const {
+        // Loose enough for any lens offset in the u, v plane
+        vec3 lens_extent = lens_radius * (abs(u) + abs(v));
+
+        ray_bundle bundle;
+        bundle.origin_min = origin - lens_extent;
+        bundle.origin_max = origin + lens_extent;
+
+        point3 target_min, target_max;
+        for (int corner = 0; corner < 4; ++corner) {
+            auto s = (corner & 1) ? s1 : s0;
+            auto t = (corner & 2) ? t1 : t0;
+            point3 target =
+                lower_left_corner + (s * horizontal) + (t * vertical);
+            target_min = corner == 0 ? target : fmin(target_min, target);
+            target_max = corner == 0 ? target : fmax(target_max, target);
+        }
+        bundle.direction_min = target_min - bundle.origin_max;
+        bundle.direction_max = target_max - bundle.origin_min;
+        return bundle;
+    }
+
+    // Screen co-ordinates s, t of the ray get_ray sends from the centre of
+    // the lens through p, or false if p is behind the camera
+    bool screen_position(const point3& p, double& s, double& t) const {
+        auto to_p = p - origin;
+        auto depth = dot(to_p, -w);
+        if (depth <= 0) {
+            return false;
+        }
+        auto on_screen =
+            origin + (screen_distance() / depth) * to_p - lower_left_corner;
+        s = dot(on_screen, horizontal) / horizontal.length_squared();
+        t = dot(on_screen, vertical) / vertical.length_squared();
+        return true;
+    }
+
+    // Area of the screen, scaled to a unit distance from the lens
+    double screen_area() const {
+        auto d = screen_distance();
+        return horizontal.length() * vertical.length() / (d * d);
+    }
+
+    bool is_pinhole() const { return lens_radius <= 0; }
+    point3 position() const { return origin; }
+    vec3 forward() const { return -w; }
+
 private:
+    double screen_distance() const {
+        return dot(origin - lower_left_corner, w);
+    }
+
     point3 origin;
     point3 lower_left_corner;
     vec3 horizontal;
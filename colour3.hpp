@@ -12,11 +12,12 @@ void write_colour(std::ostream& out, colour3 pixel_colour,
     auto b = pixel_colour.y();
     auto g = pixel_colour.z();
 
-    // Divide the colour by the number of samples and correct for gamma=2.0
+    // Divide the colour by the number of samples and correct for gamma=2.0.
+    // Estimators corrected by a control variate may dip below black.
     auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    b = sqrt(scale * b);
-    g = sqrt(scale * g);
+    r = sqrt(std::fmax(0.0, scale * r));
+    b = sqrt(std::fmax(0.0, scale * b));
+    g = sqrt(std::fmax(0.0, scale * g));
 
     // Display [0, 255] value of each colour component
     out << static_cast<int>(256 * clamp(r, 0, 0.999)) << ' '
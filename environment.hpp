@@ -0,0 +1,228 @@
+/**
+ * @file environment.hpp
+ * @author @rjkilpatrick
+ * @brief Light arriving from infinitely far away, either one colour or an
+ * HDR map
+ *
+ * A map is a latitude-longitude image around the scene, laid out as the
+ * earth texture is around its sphere, and is loaded through stb_image so
+ * Radiance .hdr files keep their full range. Its pixels are sampled in
+ * proportion to their brightness through an alias table, so a small bright
+ * sun is found by light samples rather than by chance, at a constant cost
+ * per sample.
+ *
+ */
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "sphere.hpp"
+#include "stb_image.h"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+/**
+ * @brief Picks one of n bins with probability proportional to its weight in
+ * constant time, by Vose's method
+ */
+class alias_table {
+public:
+    alias_table() {}
+    alias_table(const std::vector<double>& weights);
+
+    bool empty() const { return pmf.empty(); }
+    size_t size() const { return pmf.size(); }
+
+    // Bin for a uniform number in [0, 1)
+    size_t sample(double u) const;
+
+public:
+    std::vector<float> pmf;
+    // Each bin keeps itself with this probability, and otherwise gives its
+    // alias
+    std::vector<float> keep;
+    std::vector<uint32_t> alias;
+};
+
+alias_table::alias_table(const std::vector<double>& weights) {
+    double total = 0;
+    for (auto w : weights) {
+        total += w;
+    }
+    if (!(total > 0)) {
+        return;
+    }
+
+    auto n = weights.size();
+    pmf.resize(n);
+    keep.resize(n);
+    alias.resize(n);
+    // Bins are split into those under and over the average weight, and
+    // each under-full bin is topped up from an over-full one
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+        pmf[i] = static_cast<float>(weights[i] / total);
+        scaled[i] = weights[i] / total * n;
+        (scaled[i] < 1 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+        auto s = small.back();
+        small.pop_back();
+        auto l = large.back();
+        keep[s] = static_cast<float>(scaled[s]);
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1;
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Whatever is left is full, up to rounding
+    for (auto i : large) {
+        keep[i] = 1;
+        alias[i] = i;
+    }
+    for (auto i : small) {
+        keep[i] = 1;
+        alias[i] = i;
+    }
+}
+
+size_t alias_table::sample(double u) const {
+    auto scaled = u * pmf.size();
+    auto i = std::min(static_cast<size_t>(scaled), pmf.size() - 1);
+    return scaled - i < keep[i] ? i : alias[i];
+}
+
+class environment {
+public:
+    environment() {}
+    environment(const colour3& c) : colour(c) {}
+
+    /**
+     * @brief Loads a latitude-longitude map
+     *
+     * @param strength Scales the map's values
+     */
+    environment(const char* filename, double strength = 1);
+
+    // Light arriving along -direction
+    colour3 value(const vec3& direction) const;
+
+    // Whether there is a map to sample
+    bool sampled() const { return !distribution.empty(); }
+
+    /**
+     * @brief Picks a unit direction to the environment by brightness
+     *
+     * @param pdf Set to the density per unit solid angle
+     */
+    bool sample(vec3& direction, colour3& radiance, double& pdf) const;
+
+    // Density per unit solid angle with which `sample` picks direction
+    double pdf(const vec3& direction) const;
+
+public:
+    colour3 colour{0, 0, 0};
+    // Linear RGB, the first row at the bottom as stb_image is told to flip
+    std::vector<float> pixels;
+    int width = 0;
+    int height = 0;
+    alias_table distribution;
+
+private:
+    size_t pixel_of(const vec3& direction, double& v) const;
+};
+
+environment::environment(const char* filename, double strength) {
+    int components = 3;
+    float* data = stbi_loadf(filename, &width, &height, &components, 3);
+    if (!data) {
+        std::cerr << "ERROR: Could not load environment map `" << filename
+                  << "'.\n";
+        width = height = 0;
+        colour = colour3(1, 0, 1); // Magenta, as for missing textures
+        return;
+    }
+    pixels.assign(data, data + 3 * width * height);
+    stbi_image_free(data);
+    for (auto& x : pixels) {
+        x *= static_cast<float>(strength);
+    }
+
+    // Rows near the poles cover less of the sphere
+    std::vector<double> weights(static_cast<size_t>(width) * height);
+    for (int j = 0; j < height; ++j) {
+        auto row_area = std::sin(M_PI * (j + 0.5) / height);
+        for (int i = 0; i < width; ++i) {
+            auto p = &pixels[3 * (static_cast<size_t>(j) * width + i)];
+            weights[static_cast<size_t>(j) * width + i] =
+                (p[0] + p[1] + p[2]) / 3.0 * row_area;
+        }
+    }
+    distribution = alias_table(weights);
+}
+
+size_t environment::pixel_of(const vec3& direction, double& v) const {
+    double u;
+    get_sphere_uv(unit_vector(direction), u, v);
+    auto i = std::min(static_cast<int>(u * width), width - 1);
+    auto j = std::min(static_cast<int>(v * height), height - 1);
+    return static_cast<size_t>(j) * width + i;
+}
+
+colour3 environment::value(const vec3& direction) const {
+    if (pixels.empty()) {
+        return colour;
+    }
+    double v;
+    auto p = &pixels[3 * pixel_of(direction, v)];
+    return colour3(p[0], p[1], p[2]);
+}
+
+bool environment::sample(vec3& direction, colour3& radiance,
+                         double& pdf) const {
+    if (!sampled()) {
+        return false;
+    }
+    auto pixel = distribution.sample(random_double());
+    auto u = (pixel % width + random_double()) / width;
+    auto v = (pixel / width + random_double()) / height;
+
+    // The inverse of get_sphere_uv
+    auto phi = M_PI - 2 * M_PI * u;
+    auto cos_latitude = std::sin(M_PI * v);
+    if (cos_latitude <= 0) {
+        return false;
+    }
+    direction = vec3(cos_latitude * std::cos(phi), -std::cos(M_PI * v),
+                     cos_latitude * std::sin(phi));
+
+    // From per unit of the image, which spans 2 pi by pi radians
+    pdf = distribution.pmf[pixel] * width * height /
+          (2 * M_PI * M_PI * cos_latitude);
+    auto p = &pixels[3 * pixel];
+    radiance = colour3(p[0], p[1], p[2]);
+    return pdf > 0;
+}
+
+double environment::pdf(const vec3& direction) const {
+    if (!sampled()) {
+        return 0;
+    }
+    double v;
+    auto pixel = pixel_of(direction, v);
+    auto cos_latitude = std::sin(M_PI * v);
+    if (cos_latitude <= 0) {
+        return 0;
+    }
+    return distribution.pmf[pixel] * width * height /
+           (2 * M_PI * M_PI * cos_latitude);
+}
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * @file flat_bvh.hpp
+ * @author @rjkilpatrick
+ * @brief Builder and traversal shared by the array based BVHs
+ *
+ * The tree is an array of nodes in depth-first order: a node's left child
+ * follows it directly and `offset` points at the right child. A leaf covers
+ * the items [offset, offset + count) in the order the builder returns, and
+ * the owner decides what an item is.
+ *
+ */
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "aabb.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct flat_bvh_node {
+    aabb box;
+    uint32_t offset; // First item of a leaf or right child index
+    uint16_t count;  // Number of items, 0 for interior nodes
+    uint8_t axis;    // Split axis, decides which child is visited first
+    uint8_t spare;   // Free for the owning structure to use
+};
+
+namespace flat_bvh_detail {
+
+constexpr int bins = 12;
+
+// An item's box travels with it as the items are partitioned, so each level
+// of the build reads them in order
+struct build_item {
+    aabb box;
+    uint32_t index;
+
+    // Twice the centre, which orders and bins just as well
+    double centroid(int axis) const { return box._min[axis] + box._max[axis]; }
+    point3 centroid() const { return box._min + box._max; }
+};
+
+// Builds the subtree over items[start, end) with binned SAH
+inline uint32_t build(std::vector<build_item>& items, size_t start,
+                      size_t end, size_t max_leaf_size,
+                      std::vector<flat_bvh_node>& nodes) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({});
+
+    aabb box = items[start].box;
+    aabb centroid_box{items[start].centroid(), items[start].centroid()};
+    for (auto i = start + 1; i < end; ++i) {
+        box = surrounding_box(box, items[i].box);
+        centroid_box = surrounding_box(
+            centroid_box, aabb{items[i].centroid(), items[i].centroid()});
+    }
+    nodes[index].box = box;
+
+    auto count = end - start;
+    if (count <= max_leaf_size) {
+        nodes[index].offset = static_cast<uint32_t>(start);
+        nodes[index].count = static_cast<uint16_t>(count);
+        return index;
+    }
+
+    auto extent = centroid_box.max() - centroid_box.min();
+    int axis = 0;
+    if (extent.y() > extent[axis])
+        axis = 1;
+    if (extent.z() > extent[axis])
+        axis = 2;
+
+    size_t mid = start;
+    if (extent[axis] > 0) {
+        auto bin_of = [&](const build_item& item) {
+            auto b = static_cast<int>(
+                bins * (item.centroid(axis) - centroid_box.min()[axis]) /
+                extent[axis]);
+            return std::min(b, bins - 1);
+        };
+
+        int bin_count[bins] = {};
+        aabb bin_box[bins];
+        for (auto i = start; i < end; ++i) {
+            auto b = bin_of(items[i]);
+            bin_box[b] = bin_count[b]++ == 0
+                             ? items[i].box
+                             : surrounding_box(bin_box[b], items[i].box);
+        }
+
+        // Sweep from the right to get the cost of everything above each split
+        double right_area[bins];
+        int right_count[bins];
+        aabb sweep;
+        int n = 0;
+        for (int b = bins - 1; b > 0; --b) {
+            if (bin_count[b] > 0) {
+                sweep =
+                    n == 0 ? bin_box[b] : surrounding_box(sweep, bin_box[b]);
+                n += bin_count[b];
+            }
+            right_area[b] = n > 0 ? sweep.surface_area() : 0;
+            right_count[b] = n;
+        }
+
+        auto best_cost = infinity;
+        int best_split = 1;
+        n = 0;
+        for (int split = 1; split < bins; ++split) {
+            auto b = split - 1;
+            if (bin_count[b] > 0) {
+                sweep =
+                    n == 0 ? bin_box[b] : surrounding_box(sweep, bin_box[b]);
+                n += bin_count[b];
+            }
+            auto cost = (n > 0 ? n * sweep.surface_area() : 0) +
+                        right_count[split] * right_area[split];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = split;
+            }
+        }
+
+        mid = std::partition(items.begin() + start, items.begin() + end,
+                             [&](const build_item& item) {
+                                 return bin_of(item) < best_split;
+                             }) -
+              items.begin();
+    }
+
+    // Fall back to a median split if the bins could not separate anything
+    if (mid == start || mid == end) {
+        mid = start + count / 2;
+        std::nth_element(
+            items.begin() + start, items.begin() + mid, items.begin() + end,
+            [&](const build_item& a, const build_item& b) {
+                return a.centroid(axis) < b.centroid(axis);
+            });
+    }
+
+    build(items, start, mid, max_leaf_size, nodes);
+    auto right = build(items, mid, end, max_leaf_size, nodes);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    nodes[index].axis = static_cast<uint8_t>(axis);
+    return index;
+}
+
+} // namespace flat_bvh_detail
+
+/**
+ * @brief Builds a BVH over the given boxes
+ *
+ * @param boxes Taken by value and freed early, so moving them in keeps the
+ * peak memory of big builds down
+ * @return std::vector<uint32_t> Item order, so each leaf covers a contiguous
+ * range of it
+ */
+inline std::vector<uint32_t> build_flat_bvh(std::vector<aabb> boxes,
+                                            size_t max_leaf_size,
+                                            std::vector<flat_bvh_node>& nodes) {
+    nodes.clear();
+    if (boxes.empty()) {
+        return {};
+    }
+
+    std::vector<flat_bvh_detail::build_item> items(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        items[i].box = boxes[i];
+        items[i].index = static_cast<uint32_t>(i);
+    }
+    std::vector<aabb>().swap(boxes);
+
+    nodes.reserve(2 * items.size() / max_leaf_size + 1);
+    flat_bvh_detail::build(items, 0, items.size(), max_leaf_size, nodes);
+    std::vector<uint32_t> order(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        order[i] = items[i].index;
+    }
+    return order;
+}
+
+/**
+ * @brief Walks the tree front to back, calling hit_leaf on every leaf the ray
+ * reaches before closest_so_far
+ *
+ * @param hit_leaf Called as `bool(const flat_bvh_node&, double&)`, it should
+ * return whether it hit anything and pull in closest_so_far if so
+ */
+template <typename leaf_function>
+bool traverse_flat_bvh(const std::vector<flat_bvh_node>& nodes, const ray& r,
+                       double t_min, double& closest_so_far,
+                       leaf_function&& hit_leaf) {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    vec3 inverse_direction{1 / r.direction().x(), 1 / r.direction().y(),
+                           1 / r.direction().z()};
+    bool direction_negative[3] = {inverse_direction.x() < 0,
+                                  inverse_direction.y() < 0,
+                                  inverse_direction.z() < 0};
+
+    auto box_hit = [&](const aabb& box, double t_far) {
+        auto t_near = t_min;
+        for (int i = 0; i < 3; ++i) {
+            auto t0 = (box._min[i] - r.origin()[i]) * inverse_direction[i];
+            auto t1 = (box._max[i] - r.origin()[i]) * inverse_direction[i];
+            if (direction_negative[i]) {
+                std::swap(t0, t1);
+            }
+            t_near = fmax(t0, t_near);
+            t_far = fmin(t1, t_far);
+            if (t_far < t_near) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    constexpr int max_stack = 64;
+    uint32_t stack[max_stack];
+    int stack_size = 0;
+    uint32_t index = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const auto& n = nodes[index];
+        if (box_hit(n.box, closest_so_far)) {
+            if (n.count > 0) {
+                if (hit_leaf(n, closest_so_far)) {
+                    hit_anything = true;
+                }
+            } else if (direction_negative[n.axis]) {
+                // Visit the nearer child first
+                stack[stack_size++] = index + 1;
+                index = n.offset;
+                continue;
+            } else {
+                stack[stack_size++] = n.offset;
+                index = index + 1;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        index = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+#endif
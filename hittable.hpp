@@ -5,28 +5,120 @@
 #include "ray.hpp"
 #include "utils.hpp"
 
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
 class material; // Avoids mat A->B->A infinite loop
 
+// Materials are owned by the objects in the scene, so a hit only needs to
+// point at one. Ordered to leave no padding, which packs it into a cache
+// line when `real` is float; with double it needs two.
 struct hit_record {
     point3 p;
-    vec3 normal;
-    std::shared_ptr<material> mat_ptr;
-    double t; // Paramter along ray
-    double u;
-    double v;
+    // Push off the surface along its geometric normal that just clears the
+    // rounding error in p
+    vec3 error_offset;
+    vec3 normal; // For shading, on the side the ray came from
     bool front_face;
+    real u; // Texture co-ordinates
+    real v;
+    const material* mat_ptr;
+    double t; // Paramter along ray
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // From a bound on the rounding error in each component of p and the
+    // unit normal of the surface's actual geometry
+    inline void set_error(const vec3& p_error, const vec3& geometric_normal) {
+        error_offset = dot(abs(geometric_normal), p_error) * geometric_normal;
+    }
+};
+
+// Bound on the relative error after n rounded operations in `real`, from
+// Pharr, Jakob and Humphreys, "Physically Based Rendering" 3rd ed., 3.9
+constexpr real error_gamma(int n) {
+    constexpr real machine_epsilon = std::numeric_limits<real>::epsilon() / 2;
+    return (n * machine_epsilon) / (1 - n * machine_epsilon);
+}
+
+/**
+ * @brief Origin for a ray leaving the surface at rec in the given direction
+ *
+ * Moves the hit point along the geometric normal, to the side the ray
+ * leaves from, by just more than the error in the point. The ray then cannot
+ * hit the surface it starts on, without needing an epsilon for t_min. An
+ * interpolated shading normal may lean away from the geometry, so neither
+ * the push nor its side is taken from it.
+ */
+inline point3 offset_ray_origin(const hit_record& rec, const vec3& direction) {
+    vec3 offset = rec.error_offset;
+    if (dot(direction, offset) < 0) {
+        offset = -offset;
+    }
+
+    // Round away from the surface so the offset is never lost
+    constexpr auto real_infinity = std::numeric_limits<real>::infinity();
+    point3 origin = rec.p + offset;
+    for (int i = 0; i < 3; ++i) {
+        if (offset[i] > 0) {
+            origin[i] = std::nextafter(origin[i], real_infinity);
+        } else if (offset[i] < 0) {
+            origin[i] = std::nextafter(origin[i], -real_infinity);
+        }
+    }
+    return origin;
+}
+
+class hittable;
+
+// What intersecting records about a hit. Many candidate hits are found and
+// discarded, so the full hit_record is only worked out for the closest one.
+struct hit_query {
+    double t;
+    const hittable* object; // The primitive that was hit, which shades it
+    uint32_t primitive;     // Which of the object's primitives, if it has many
+    double u, v;            // Parametric co-ordinates, for the object to use
 };
 
+static_assert(sizeof(hit_query) <= 64, "hit_query should fit a cache line");
+#ifdef RAYTRACER_SINGLE_PRECISION
+static_assert(sizeof(hit_record) <= 64, "hit_record should fit a cache line");
+#endif
+
+/**
+ * @brief Anything a ray can hit
+ *
+ * Objects implement `intersect`, to find their closest hit cheaply, and
+ * `shade`, to fill in the hit_record for the one hit that is kept.
+ * Aggregates, which only pass hits on from their members, shade nothing.
+ * `hit` is no longer virtual: an extension that overrode it must now split
+ * it into `intersect` and `shade`, setting `query.object` to itself.
+ */
 class hittable {
 public:
-    virtual bool hit(const ray& r, double t_min, double t_max,
-                     hit_record& rec) const = 0;
+    // Finds the closest hit, leaving query untouched if there is none
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const = 0;
+
+    // Fills in rec for a hit intersect found on this object
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const = 0;
+
     virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+
+    // Intersects, then shades only the closest hit
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+        hit_query query;
+        if (!intersect(r, t_min, t_max, query)) {
+            return false;
+        }
+        query.object->shade(r, query, rec);
+        return true;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -15,8 +15,12 @@ public:
     void clear() { objects.clear(); }
     void add(std::shared_ptr<hittable> object) { objects.push_back(object); }
 
-    virtual bool hit(const ray& r, double tmin, double tmax,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double tmin, double tmax,
+                           hit_query& query) const override;
+
+    // Hits name the member that was hit, which shades them itself
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {}
 
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override;
@@ -25,17 +29,15 @@ public:
     std::vector<std::shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double tmin, double tmax,
-                        hit_record& rec) const {
-    hit_record temp_rec;
+bool hittable_list::intersect(const ray& r, double tmin, double tmax,
+                              hit_query& query) const {
     bool hit_anything = false;
     auto closest_so_far = tmax; // The lowest value of t so far
 
     for (const auto& object : objects) {
-        if (object->hit(r, tmin, closest_so_far, temp_rec)) {
+        if (object->intersect(r, tmin, closest_so_far, query)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = query.t;
         }
     }
 
@@ -60,4 +62,24 @@ bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const {
     return true;
 }
 
+/**
+ * @brief Moves the objects without a bounding box, such as planes, out of a
+ * list so an acceleration structure can be built over the rest
+ *
+ * @return hittable_list The objects that were removed
+ */
+hittable_list take_unbounded(hittable_list& list, double t0, double t1) {
+    hittable_list bounded, unbounded;
+    aabb box;
+    for (const auto& object : list.objects) {
+        if (object->bounding_box(t0, t1, box)) {
+            bounded.add(object);
+        } else {
+            unbounded.add(object);
+        }
+    }
+    list.objects.swap(bounded.objects);
+    return unbounded;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,456 @@
+/**
+ * @file kd_tree.hpp
+ * @author @rjkilpatrick
+ * @brief kd-tree built with the surface area heuristic
+ *
+ * An alternative to `bvh_node` that tends to do better on scenes made mostly
+ * of axis-aligned rectangles. Built with the O(n log n) event sweep of Wald
+ * and Havran, "On building fast kd-trees for ray tracing" (2006).
+ *
+ */
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include "hittable_list.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// 8 byte node, as in PBRT. The low two bits of `flags` hold the split axis,
+// or 3 for a leaf, and the rest hold either the index of the child above the
+// split or the number of primitives in the leaf. The child below the split
+// is always stored straight after its parent.
+struct kd_node {
+    union {
+        float split;                // Interior
+        uint32_t one_primitive;     // Leaf with a single primitive
+        uint32_t primitive_offset;  // Leaf, into kd_tree::primitive_indices
+    };
+    uint32_t flags;
+
+    void init_leaf(const uint32_t* primitive_numbers, uint32_t n,
+                   std::vector<uint32_t>& primitive_indices) {
+        flags = 3 | (n << 2);
+        if (n == 0) {
+            one_primitive = 0;
+        } else if (n == 1) {
+            one_primitive = primitive_numbers[0];
+        } else {
+            primitive_offset = static_cast<uint32_t>(primitive_indices.size());
+            primitive_indices.insert(primitive_indices.end(), primitive_numbers,
+                                     primitive_numbers + n);
+        }
+    }
+
+    void init_interior(int axis, uint32_t above_child, float s) {
+        split = s;
+        flags = axis | (above_child << 2);
+    }
+
+    bool is_leaf() const { return (flags & 3) == 3; }
+    int split_axis() const { return flags & 3; }
+    uint32_t n_primitives() const { return flags >> 2; }
+    uint32_t above_child() const { return flags >> 2; }
+};
+
+static_assert(sizeof(kd_node) == 8, "kd_node should pack into 8 bytes");
+
+// Start, end and planar events of one primitive's box along one axis
+struct kd_event {
+    enum event_type { end = 0, planar = 1, start = 2 };
+
+    double position;
+    uint32_t primitive;
+    int axis;
+    event_type type;
+};
+
+inline bool operator<(const kd_event& a, const kd_event& b) {
+    if (a.axis != b.axis)
+        return a.axis < b.axis;
+    if (a.position != b.position)
+        return a.position < b.position;
+    return a.type < b.type;
+}
+
+class kd_tree : public hittable {
+public:
+    kd_tree(){};
+
+    kd_tree(const hittable_list& list, double time0, double time1)
+        : kd_tree(list.objects, time0, time1) {}
+
+    kd_tree(const std::vector<std::shared_ptr<hittable>>& objects,
+            double time0, double time1);
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    // Hits name the primitive that was hit, which shades them itself
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {}
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override {
+        output_box = bounds;
+        return !nodes.empty();
+    }
+
+public:
+    // Relative costs of stepping through a node and testing a primitive
+    static constexpr double traversal_cost = 1.0;
+    static constexpr double intersection_cost = 2.0;
+    // Discount for splits that cut off empty space
+    static constexpr double empty_bonus = 0.8;
+
+    std::vector<std::shared_ptr<hittable>> primitives;
+    std::vector<uint32_t> primitive_indices;
+    std::vector<kd_node> nodes;
+    aabb bounds;
+
+private:
+    enum class side { left, right, both };
+
+    struct kd_split {
+        double cost;
+        int axis;
+        double position;
+        bool planar_left;
+    };
+
+    void build(std::vector<kd_event>& events, const aabb& voxel,
+               size_t n_primitives, int depth_remaining);
+    kd_split find_split(const std::vector<kd_event>& events, const aabb& voxel,
+                        size_t n_primitives) const;
+    void make_leaf(const std::vector<kd_event>& events);
+    void add_events(uint32_t primitive, const aabb& voxel,
+                    std::vector<kd_event>& events) const;
+
+    // Scratch space for the builder, indexed by primitive
+    std::vector<aabb> primitive_bounds;
+    std::vector<side> sides;
+};
+
+kd_tree::kd_tree(const std::vector<std::shared_ptr<hittable>>& objects,
+                 double time0, double time1)
+    : primitives(objects) {
+    if (primitives.empty()) {
+        return;
+    }
+
+    primitive_bounds.resize(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        if (!primitives[i]->bounding_box(time0, time1, primitive_bounds[i])) {
+            std::cerr << "No bounding box in kd_tree constructor.\n";
+        }
+        bounds = i == 0 ? primitive_bounds[i]
+                        : surrounding_box(bounds, primitive_bounds[i]);
+    }
+
+    // The only sort of the whole build, everything after it is linear
+    std::vector<kd_event> events;
+    events.reserve(6 * primitives.size());
+    for (uint32_t i = 0; i < primitives.size(); ++i) {
+        add_events(i, bounds, events);
+    }
+    std::sort(events.begin(), events.end());
+
+    sides.resize(primitives.size());
+    auto max_depth = static_cast<int>(
+        std::round(8 + 1.3 * std::log2(double(primitives.size()))));
+    build(events, bounds, primitives.size(), max_depth);
+
+    primitive_bounds.clear();
+    primitive_bounds.shrink_to_fit();
+    sides.clear();
+    sides.shrink_to_fit();
+}
+
+// Appends the events of the part of a primitive's box inside voxel
+void kd_tree::add_events(uint32_t primitive, const aabb& voxel,
+                         std::vector<kd_event>& events) const {
+    auto clipped_min = fmax(primitive_bounds[primitive].min(), voxel.min());
+    auto clipped_max = fmin(primitive_bounds[primitive].max(), voxel.max());
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (clipped_min[axis] == clipped_max[axis]) {
+            events.push_back(
+                {clipped_min[axis], primitive, axis, kd_event::planar});
+        } else {
+            events.push_back(
+                {clipped_min[axis], primitive, axis, kd_event::start});
+            events.push_back(
+                {clipped_max[axis], primitive, axis, kd_event::end});
+        }
+    }
+}
+
+kd_tree::kd_split kd_tree::find_split(const std::vector<kd_event>& events,
+                                      const aabb& voxel,
+                                      size_t n_primitives) const {
+    kd_split best{infinity, -1, 0, false};
+    size_t n_left[3] = {0, 0, 0};
+    size_t n_right[3] = {n_primitives, n_primitives, n_primitives};
+    auto inverse_area = 1.0 / voxel.surface_area();
+
+    // Sweep every candidate plane, events are sorted by axis then position
+    for (size_t i = 0; i < events.size();) {
+        auto axis = events[i].axis;
+        auto position = events[i].position;
+        size_t ending = 0, lying = 0, starting = 0;
+
+        auto at_plane = [&](kd_event::event_type type) {
+            return i < events.size() && events[i].axis == axis &&
+                   events[i].position == position && events[i].type == type;
+        };
+        while (at_plane(kd_event::end)) {
+            ++ending;
+            ++i;
+        }
+        while (at_plane(kd_event::planar)) {
+            ++lying;
+            ++i;
+        }
+        while (at_plane(kd_event::start)) {
+            ++starting;
+            ++i;
+        }
+
+        n_right[axis] -= lying + ending;
+
+        // Planes on the voxel boundary cut nothing off
+        if (position > voxel.min()[axis] && position < voxel.max()[axis]) {
+            aabb left = voxel, right = voxel;
+            left._max[axis] = position;
+            right._min[axis] = position;
+            auto p_left = left.surface_area() * inverse_area;
+            auto p_right = right.surface_area() * inverse_area;
+
+            auto cost = [&](size_t l, size_t r) {
+                auto bonus = (l == 0 || r == 0) ? empty_bonus : 1.0;
+                return bonus *
+                       (traversal_cost +
+                        intersection_cost * (p_left * l + p_right * r));
+            };
+            auto cost_planar_left = cost(n_left[axis] + lying, n_right[axis]);
+            auto cost_planar_right = cost(n_left[axis], n_right[axis] + lying);
+
+            if (cost_planar_left < best.cost) {
+                best = {cost_planar_left, axis, position, true};
+            }
+            if (cost_planar_right < best.cost) {
+                best = {cost_planar_right, axis, position, false};
+            }
+        }
+
+        n_left[axis] += starting + lying;
+    }
+
+    return best;
+}
+
+void kd_tree::make_leaf(const std::vector<kd_event>& events) {
+    // Every primitive has a start or planar event along x
+    std::vector<uint32_t> leaf_primitives;
+    for (const auto& event : events) {
+        if (event.axis == 0 && event.type != kd_event::end) {
+            leaf_primitives.push_back(event.primitive);
+        }
+    }
+
+    nodes.emplace_back();
+    nodes.back().init_leaf(leaf_primitives.data(),
+                           static_cast<uint32_t>(leaf_primitives.size()),
+                           primitive_indices);
+}
+
+void kd_tree::build(std::vector<kd_event>& events, const aabb& voxel,
+                    size_t n_primitives, int depth_remaining) {
+    if (depth_remaining == 0 || n_primitives <= 1) {
+        make_leaf(events);
+        return;
+    }
+
+    auto best = find_split(events, voxel, n_primitives);
+    auto leaf_cost = intersection_cost * n_primitives;
+
+    // Nodes store the split in single precision so split and classify against
+    // the rounded plane to keep the children conservative
+    auto split = static_cast<float>(best.position);
+    if (best.axis < 0 || best.cost >= leaf_cost ||
+        !(split > voxel.min()[best.axis] && split < voxel.max()[best.axis])) {
+        make_leaf(events);
+        return;
+    }
+    int axis = best.axis;
+    double position = split;
+
+    // Classify the primitives against the plane
+    for (const auto& event : events) {
+        sides[event.primitive] = side::both;
+    }
+    for (const auto& event : events) {
+        if (event.axis != axis) {
+            continue;
+        }
+        if (event.type == kd_event::end && event.position <= position) {
+            sides[event.primitive] = side::left;
+        } else if (event.type == kd_event::start &&
+                   event.position >= position) {
+            sides[event.primitive] = side::right;
+        } else if (event.type == kd_event::planar) {
+            if (event.position < position ||
+                (event.position == position && best.planar_left)) {
+                sides[event.primitive] = side::left;
+            } else {
+                sides[event.primitive] = side::right;
+            }
+        }
+    }
+
+    aabb left_voxel = voxel, right_voxel = voxel;
+    left_voxel._max[axis] = position;
+    right_voxel._min[axis] = position;
+
+    // Events of one-sided primitives stay sorted, only the straddling ones
+    // need new events which are sorted on their own and merged back in
+    std::vector<kd_event> left_only, right_only, both_left, both_right;
+    size_t n_left = 0, n_right = 0;
+    for (const auto& event : events) {
+        switch (sides[event.primitive]) {
+        case side::left:
+            left_only.push_back(event);
+            break;
+        case side::right:
+            right_only.push_back(event);
+            break;
+        case side::both:
+            break;
+        }
+    }
+    for (const auto& event : events) {
+        if (event.axis != 0 || event.type == kd_event::end) {
+            continue;
+        }
+        switch (sides[event.primitive]) {
+        case side::left:
+            ++n_left;
+            break;
+        case side::right:
+            ++n_right;
+            break;
+        case side::both:
+            ++n_left;
+            ++n_right;
+            add_events(event.primitive, left_voxel, both_left);
+            add_events(event.primitive, right_voxel, both_right);
+            break;
+        }
+    }
+    std::vector<kd_event>().swap(events);
+
+    std::sort(both_left.begin(), both_left.end());
+    std::sort(both_right.begin(), both_right.end());
+
+    std::vector<kd_event> left_events, right_events;
+    left_events.reserve(left_only.size() + both_left.size());
+    std::merge(left_only.begin(), left_only.end(), both_left.begin(),
+               both_left.end(), std::back_inserter(left_events));
+    std::vector<kd_event>().swap(left_only);
+    std::vector<kd_event>().swap(both_left);
+
+    right_events.reserve(right_only.size() + both_right.size());
+    std::merge(right_only.begin(), right_only.end(), both_right.begin(),
+               both_right.end(), std::back_inserter(right_events));
+    std::vector<kd_event>().swap(right_only);
+    std::vector<kd_event>().swap(both_right);
+
+    auto node_index = nodes.size();
+    nodes.emplace_back();
+
+    build(left_events, left_voxel, n_left, depth_remaining - 1);
+    auto above_child = static_cast<uint32_t>(nodes.size());
+    nodes[node_index].init_interior(axis, above_child, split);
+    build(right_events, right_voxel, n_right, depth_remaining - 1);
+}
+
+bool kd_tree::intersect(const ray& r, double t_min, double t_max,
+                        hit_query& query) const {
+    auto t_enter = t_min;
+    auto t_exit = t_max;
+    if (nodes.empty() || !bounds.clip(r, t_enter, t_exit)) {
+        return false;
+    }
+
+    struct kd_todo {
+        uint32_t node;
+        double t_enter, t_exit;
+    };
+    constexpr int max_todo = 64;
+    kd_todo todo[max_todo];
+    int todo_count = 0;
+
+    vec3 inverse_direction{1 / r.direction().x(), 1 / r.direction().y(),
+                           1 / r.direction().z()};
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+    uint32_t index = 0;
+
+    while (true) {
+        // Nothing left to visit can be nearer than the hit we have
+        if (closest_so_far < t_enter) {
+            break;
+        }
+
+        const auto& node = nodes[index];
+        if (!node.is_leaf()) {
+            auto axis = node.split_axis();
+            auto t_plane =
+                (node.split - r.origin()[axis]) * inverse_direction[axis];
+
+            // Visit the child on the origin's side of the split first
+            bool below_first =
+                (r.origin()[axis] < node.split) ||
+                (r.origin()[axis] == node.split && r.direction()[axis] <= 0);
+            auto first = below_first ? index + 1 : node.above_child();
+            auto second = below_first ? node.above_child() : index + 1;
+
+            if (t_plane > t_exit || t_plane <= 0) {
+                index = first;
+            } else if (t_plane < t_enter) {
+                index = second;
+            } else {
+                todo[todo_count++] = {second, t_plane, t_exit};
+                index = first;
+                t_exit = t_plane;
+            }
+            continue;
+        }
+
+        auto n = node.n_primitives();
+        for (uint32_t i = 0; i < n; ++i) {
+            auto primitive =
+                n == 1 ? node.one_primitive
+                       : primitive_indices[node.primitive_offset + i];
+            if (primitives[primitive]->intersect(r, t_min, closest_so_far,
+                                                 query)) {
+                hit_anything = true;
+                closest_so_far = query.t;
+            }
+        }
+
+        if (todo_count == 0) {
+            break;
+        }
+        --todo_count;
+        index = todo[todo_count].node;
+        t_enter = todo[todo_count].t_enter;
+        t_exit = todo[todo_count].t_exit;
+    }
+
+    return hit_anything;
+}
+
+#endif
@@ -0,0 +1,319 @@
+/**
+ * @file light_bvh.hpp
+ * @author @rjkilpatrick
+ * @brief Hierarchy over emitters for picking one by its likely contribution
+ *
+ * Each node bounds where the lights below it are, how much power they emit
+ * and the cone their surface normals lie in. Walking down from the root, a
+ * child is chosen in proportion to a conservative estimate of the light it
+ * could send to the shading point, so of thousands of lights the few that
+ * are near and face it are picked far more often than the rest. The tree's
+ * shape comes from the binned SAH builder of the geometry BVHs, with one
+ * light per leaf.
+ *
+ */
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "aabb.hpp"
+#include "flat_bvh.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct light_bounds {
+    aabb box;
+    double power = 0;
+    // Cone holding the surface normals, about a unit axis
+    vec3 axis{0, 0, 1};
+    double cos_normals = 1;
+    // How far from its normal a surface emits, a right angle for diffuse
+    double cos_emission = 0;
+    // Whether light leaves both sides of the surfaces
+    bool two_sided = false;
+
+    /**
+     * @brief Upper estimate of the light reaching p, from power over squared
+     * distance and the smallest angles the bounds allow
+     *
+     * @param n Normal of the surface at p, which is only lit from above it,
+     * or zero for no such limit
+     */
+    double importance(const point3& p, const vec3& n) const;
+};
+
+/**
+ * @brief Bounds of two sets of lights together
+ */
+light_bounds merge(const light_bounds& a, const light_bounds& b);
+
+class light_bvh {
+public:
+    light_bvh() {}
+    light_bvh(const std::vector<light_bounds>& lights);
+
+    bool empty() const { return nodes.empty(); }
+
+    /**
+     * @brief Picks a light by its importance at p
+     *
+     * @param pmf Set to the probability of picking that light
+     * @return false if no light can reach p
+     */
+    bool pick(const point3& p, const vec3& n, size_t& light,
+              double& pmf) const;
+
+    /**
+     * @brief Calls f(light, pmf) for every light whose box holds where, with
+     * the probability `pick` at p would give it
+     */
+    template <typename function>
+    void for_each_containing(const point3& p, const vec3& n,
+                             const point3& where, function&& f) const;
+
+public:
+    std::vector<flat_bvh_node> nodes;
+    std::vector<light_bounds> bounds; // Of each node
+    std::vector<uint32_t> order;      // Light of each leaf's offset
+
+private:
+    // Chances of going left and right at an interior node, or false if
+    // neither child can reach p
+    bool split(uint32_t index, const point3& p, const vec3& n, double& left,
+               double& right) const;
+};
+
+namespace light_bvh_detail {
+
+// cos and sin of max(0, a - b), given those of the angles a and b
+inline double cos_sub_clamped(double sin_a, double cos_a, double sin_b,
+                              double cos_b) {
+    return cos_a > cos_b ? 1 : cos_a * cos_b + sin_a * sin_b;
+}
+
+inline double sin_sub_clamped(double sin_a, double cos_a, double sin_b,
+                              double cos_b) {
+    return cos_a > cos_b ? 0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+inline double sin_from_cos(double cosine) {
+    return std::sqrt(std::fmax(0.0, 1 - cosine * cosine));
+}
+
+// Smallest cone about a new axis holding the cones about unit axes a and b
+inline void merge_cones(const vec3& a, double cos_a, const vec3& b,
+                        double cos_b, vec3& axis, double& cos_merged) {
+    auto theta_a = std::acos(clamp(cos_a, -1, 1));
+    auto theta_b = std::acos(clamp(cos_b, -1, 1));
+    auto theta_d = std::acos(clamp(dot(a, b), -1, 1));
+    if (std::fmin(theta_d + theta_b, M_PI) <= theta_a) {
+        axis = a;
+        cos_merged = cos_a;
+        return;
+    }
+    if (std::fmin(theta_d + theta_a, M_PI) <= theta_b) {
+        axis = b;
+        cos_merged = cos_b;
+        return;
+    }
+
+    auto theta = (theta_a + theta_d + theta_b) / 2;
+    auto rotation_axis = cross(a, b);
+    if (theta >= M_PI || rotation_axis.length_squared() == 0) {
+        axis = a;
+        cos_merged = -1;
+        return;
+    }
+    // Turn a towards b, by Rodrigues' formula
+    auto k = unit_vector(rotation_axis);
+    auto angle = theta - theta_a;
+    axis = std::cos(angle) * a + std::sin(angle) * cross(k, a) +
+           (1 - std::cos(angle)) * dot(k, a) * k;
+    cos_merged = std::cos(theta);
+}
+
+} // namespace light_bvh_detail
+
+double light_bounds::importance(const point3& p, const vec3& n) const {
+    using namespace light_bvh_detail;
+    if (power <= 0) {
+        return 0;
+    }
+
+    auto centre = 0.5 * (box.min() + box.max());
+    double radius_squared = 0.25 * (box.max() - box.min()).length_squared();
+    vec3 to_p = p - centre;
+    double distance_squared = to_p.length_squared();
+
+    // Angle the box's bounding sphere fills, all of them from inside it
+    double cos_box = -1;
+    if (distance_squared > radius_squared) {
+        cos_box = std::sqrt(1 - radius_squared / distance_squared);
+    }
+    auto sin_box = sin_from_cos(cos_box);
+
+    vec3 w{0, 0, 0};
+    if (distance_squared > 0) {
+        w = to_p / std::sqrt(distance_squared);
+    }
+    double cos_w = dot(axis, w);
+    if (two_sided) {
+        cos_w = std::fabs(cos_w);
+    }
+
+    // Smallest angle between p and the normal of any point in the box
+    auto cos_x = cos_sub_clamped(sin_from_cos(cos_w), cos_w,
+                                 sin_from_cos(cos_normals), cos_normals);
+    auto sin_x = sin_sub_clamped(sin_from_cos(cos_w), cos_w,
+                                 sin_from_cos(cos_normals), cos_normals);
+    auto cos_emitted = cos_sub_clamped(sin_x, cos_x, sin_box, cos_box);
+    if (cos_emitted <= cos_emission) {
+        return 0;
+    }
+
+    // Nearby boxes count as if p were at their edge
+    auto result =
+        power * cos_emitted / std::fmax(distance_squared, radius_squared);
+
+    // Smallest angle between n and the direction to any point in the box
+    if (n.length_squared() > 0) {
+        double cos_n = -dot(w, n);
+        result *= std::fmax(
+            0.0, cos_sub_clamped(sin_from_cos(cos_n), cos_n, sin_box, cos_box));
+    }
+    return result;
+}
+
+light_bounds merge(const light_bounds& a, const light_bounds& b) {
+    if (a.power <= 0) {
+        return b;
+    }
+    if (b.power <= 0) {
+        return a;
+    }
+
+    light_bounds merged;
+    merged.box = surrounding_box(a.box, b.box);
+    merged.power = a.power + b.power;
+    light_bvh_detail::merge_cones(a.axis, a.cos_normals, b.axis,
+                                  b.cos_normals, merged.axis,
+                                  merged.cos_normals);
+    merged.cos_emission = std::fmin(a.cos_emission, b.cos_emission);
+    merged.two_sided = a.two_sided || b.two_sided;
+    return merged;
+}
+
+light_bvh::light_bvh(const std::vector<light_bounds>& lights) {
+    std::vector<aabb> boxes(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i) {
+        boxes[i] = lights[i].box;
+    }
+    order = build_flat_bvh(std::move(boxes), 1, nodes);
+
+    // Children follow their parents, so a backward pass sees them first
+    bounds.resize(nodes.size());
+    for (auto i = nodes.size(); i-- > 0;) {
+        const auto& node = nodes[i];
+        if (node.count > 0) {
+            bounds[i] = lights[order[node.offset]];
+        } else {
+            bounds[i] = merge(bounds[i + 1], bounds[node.offset]);
+        }
+    }
+}
+
+bool light_bvh::split(uint32_t index, const point3& p, const vec3& n,
+                      double& left, double& right) const {
+    auto left_importance = bounds[index + 1].importance(p, n);
+    auto right_importance = bounds[nodes[index].offset].importance(p, n);
+    auto total = left_importance + right_importance;
+    if (!(total > 0)) {
+        return false;
+    }
+    left = left_importance / total;
+    right = 1 - left;
+    return true;
+}
+
+bool light_bvh::pick(const point3& p, const vec3& n, size_t& light,
+                     double& pmf) const {
+    // A lone light is only picked if it can reach p
+    if (nodes.empty() ||
+        (nodes[0].count > 0 && !(bounds[0].importance(p, n) > 0))) {
+        return false;
+    }
+
+    uint32_t index = 0;
+    pmf = 1;
+    while (nodes[index].count == 0) {
+        double left, right;
+        if (!split(index, p, n, left, right)) {
+            return false;
+        }
+        if (random_double() < left) {
+            index = index + 1;
+            pmf *= left;
+        } else {
+            index = nodes[index].offset;
+            pmf *= right;
+        }
+    }
+    light = order[nodes[index].offset];
+    return true;
+}
+
+template <typename function>
+void light_bvh::for_each_containing(const point3& p, const vec3& n,
+                                    const point3& where, function&& f) const {
+    if (nodes.empty() ||
+        (nodes[0].count > 0 && !(bounds[0].importance(p, n) > 0))) {
+        return;
+    }
+
+    // Hit points are only near their light's surface, so boxes are grown
+    // by a little of their size
+    auto contains = [&](const aabb& box) {
+        auto margin = EPSILON * (box.max() - box.min()).length();
+        for (int i = 0; i < 3; ++i) {
+            if (where[i] < box.min()[i] - margin ||
+                where[i] > box.max()[i] + margin) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    struct entry {
+        uint32_t index;
+        double pmf;
+    };
+    constexpr int max_stack = 64;
+    entry stack[max_stack];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 1};
+    while (stack_size > 0) {
+        auto e = stack[--stack_size];
+        const auto& node = nodes[e.index];
+        if (!contains(bounds[e.index].box)) {
+            continue;
+        }
+        if (node.count > 0) {
+            f(static_cast<size_t>(order[node.offset]), e.pmf);
+            continue;
+        }
+        double left, right;
+        if (!split(e.index, p, n, left, right)) {
+            continue;
+        }
+        if (left > 0 && stack_size < max_stack) {
+            stack[stack_size++] = {e.index + 1, e.pmf * left};
+        }
+        if (right > 0 && stack_size < max_stack) {
+            stack[stack_size++] = {node.offset, e.pmf * right};
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,544 @@
+/**
+ * @file lights.hpp
+ * @author @rjkilpatrick
+ * @brief Emitters gathered from a scene so they can be sampled directly
+ *
+ * Rectangles and spheres with `diffuse_light` materials are collected into a
+ * list. At a hit on a material that `samples_lights`, one of them is picked
+ * through a `light_bvh`, by how much light it could send there, then a point
+ * on it, and its light counted if a shadow ray reaches it. A path that
+ * then bounces into a sampled light counts its emission as well, and the two
+ * are weighted by the power heuristic: light samples win on small lights,
+ * and the material's own samples on large lights and glossy reflections.
+ * Emitters of other shapes are still found by chance, and objects that are
+ * already batched or accelerated are not searched for emitters. An
+ * environment map is sampled as one more light, in half of the samples when
+ * there are others.
+ *
+ */
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "aarect.hpp"
+#include "box.hpp"
+#include "environment.hpp"
+#include "hittable_list.hpp"
+#include "light_bvh.hpp"
+#include "material.hpp"
+#include "moving_sphere.hpp"
+#include "plane.hpp"
+#include "sphere.hpp"
+#include "triangle_mesh.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct area_light {
+    enum class shape { rect, sphere };
+
+    shape type;
+    point3 corner;       // Rectangles: the corner where u = v = 0
+    vec3 edge_u, edge_v; // Rectangles: the sides along u and v
+    point3 centre;       // Spheres
+    double radius;       // Spheres
+    double area;
+    const material* mat;
+};
+
+// A point on a light, seen from a point in the scene
+struct light_sample {
+    point3 p; // Or the unit direction to the environment
+    colour3 emitted;
+    double pdf; // Per unit solid angle, including the choice of light
+    bool at_infinity = false;
+};
+
+// A point on a light and a direction its light leaves along, for following
+// light out into the scene
+struct emission_sample {
+    point3 p;
+    vec3 normal; // Outward, or either side of a rectangle
+    vec3 direction;
+    colour3 emitted;
+    double pdf_position;  // Per unit area, including the choice of light
+    double pdf_direction; // Per unit solid angle
+    bool two_sided;       // Whether light leaves both sides
+};
+
+// The surface a path scattered from, for weighting the light it then finds
+struct path_vertex {
+    point3 p;
+    vec3 normal;
+    // Of scattering in the direction taken, or 0 if the lights were not
+    // sampled there
+    double pdf = 0;
+};
+
+// Weight of a sample drawn with density pdf against one also drawn with
+// density other_pdf
+inline double power_heuristic(double pdf, double other_pdf) {
+    auto a = pdf * pdf;
+    auto b = other_pdf * other_pdf;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+class light_list {
+public:
+    light_list() {}
+    light_list(const hittable_list& world, const environment* sky = nullptr)
+        : sky(sky) {
+        add(world);
+    }
+
+    // Collects the emitters of a scene which can be sampled
+    void add(const hittable_list& world);
+
+    bool empty() const { return lights.empty() && !samples_environment(); }
+
+    bool samples_environment() const { return sky && sky->sampled(); }
+
+    // Density per unit solid angle with which `sample` picks the unit
+    // direction to the environment
+    double environment_pdf(const vec3& direction) const {
+        return samples_environment()
+                   ? environment_share() * sky->pdf(direction)
+                   : 0;
+    }
+
+    // Whether every emitter with this material is in the list
+    bool samples(const material* m) const {
+        return std::find(sampled_materials.begin(), sampled_materials.end(),
+                         m) != sampled_materials.end();
+    }
+
+    // Picks a point on a light seen from a surface with the given normal, or
+    // returns false if it cannot be seen
+    bool sample(const point3& from, const vec3& normal,
+                light_sample& s) const;
+
+    // Density per unit solid angle with which `sample` picks the point of a
+    // light at rec, seen from a surface
+    double pdf(const path_vertex& from, const hit_record& rec) const;
+
+    // Picks a light by its power, a point on it and a cosine-weighted
+    // direction out of it
+    bool sample_emission(emission_sample& e) const;
+
+    // Density per unit area with which `sample_emission` starts at p on an
+    // emitter with material m
+    double emission_pdf_position(const material* m, const point3& p) const;
+
+    // Density per unit solid angle with which `sample_emission` leaves p on
+    // an emitter with material m along the unit direction
+    double emission_pdf_direction(const material* m, const point3& p,
+                                  const vec3& direction) const;
+
+    // Light arriving at rec straight from the lights, towards r's origin
+    colour3 direct_light(const ray& r, const hit_record& rec,
+                         const hittable& world) const {
+        return direct_light(r, rec, world, [&](const vec3& direction) {
+            return rec.mat_ptr->scattering_pdf(r, rec, direction);
+        });
+    }
+
+    /**
+     * @brief As above, where bounces from rec are not drawn from its
+     * material alone
+     *
+     * @param bounce_pdf Gives the density with which a bounce picks a unit
+     * direction, to weight the light sample against
+     */
+    template <typename pdf_function>
+    colour3 direct_light(const ray& r, const hit_record& rec,
+                         const hittable& world,
+                         pdf_function&& bounce_pdf) const;
+
+public:
+    std::vector<area_light> lights;
+    std::vector<const material*> sampled_materials;
+    light_bvh tree;
+    alias_table by_power;
+    const environment* sky = nullptr;
+
+private:
+    // Share of samples that go to the environment
+    double environment_share() const {
+        if (!samples_environment()) {
+            return 0;
+        }
+        return lights.empty() ? 1 : 0.5;
+    }
+
+    void collect(const hittable_list& list,
+                 std::vector<const material*>& unsampled);
+    void add_rect(const point3& corner, const vec3& edge_u, const vec3& edge_v,
+                  const material* m);
+};
+
+namespace light_detail {
+
+inline double average(const colour3& c) { return (c.x() + c.y() + c.z()) / 3; }
+
+// Power is estimated from the emission at the middle of a light
+inline light_bounds bounds(const area_light& light) {
+    light_bounds b;
+    double radiance;
+    if (light.type == area_light::shape::rect) {
+        auto far_corner = light.corner + light.edge_u + light.edge_v;
+        b.box = aabb(fmin(light.corner, far_corner),
+                     fmax(light.corner, far_corner));
+        radiance = average(light.mat->emitted(
+            0.5, 0.5, 0.5 * (light.corner + far_corner)));
+        b.axis = unit_vector(cross(light.edge_u, light.edge_v));
+        b.cos_normals = 1;
+        b.two_sided = true;
+    } else {
+        vec3 extent(light.radius, light.radius, light.radius);
+        b.box = aabb(light.centre - extent, light.centre + extent);
+        radiance = average(light.mat->emitted(0.5, 0.5, light.centre));
+        b.cos_normals = -1;
+    }
+    b.power = M_PI * light.area * std::fmax(0.0, radiance);
+    return b;
+}
+
+// Whether p is on the surface of the light
+inline bool contains(const area_light& light, const point3& p) {
+    if (light.type == area_light::shape::rect) {
+        auto local = p - light.corner;
+        auto normal = cross(light.edge_u, light.edge_v) / light.area;
+        auto u = dot(local, light.edge_u) / light.edge_u.length_squared();
+        auto v = dot(local, light.edge_v) / light.edge_v.length_squared();
+        return std::fabs(dot(local, normal)) <=
+                   EPSILON * std::sqrt(light.area) &&
+               u >= 0 && u <= 1 && v >= 0 && v <= 1;
+    }
+    auto off_surface = (p - light.centre).length() - light.radius;
+    return std::fabs(off_surface) <= EPSILON * light.radius;
+}
+
+// Density per unit solid angle of picking p on the light, seen from a point
+inline double solid_angle_pdf(const area_light& light, const point3& from,
+                              const point3& p) {
+    auto to_light = p - from;
+    auto distance_squared = to_light.length_squared();
+    if (distance_squared <= 0) {
+        return 0;
+    }
+
+    if (light.type == area_light::shape::rect) {
+        auto normal = cross(light.edge_u, light.edge_v) / light.area;
+        auto cosine =
+            std::fabs(dot(normal, to_light)) / std::sqrt(distance_squared);
+        return cosine > 0 ? distance_squared / (cosine * light.area) : 0;
+    }
+
+    // Uniform over the cone the sphere fills
+    auto centre_distance_squared = (light.centre - from).length_squared();
+    auto radius_squared = light.radius * light.radius;
+    if (centre_distance_squared <= radius_squared) {
+        return 0;
+    }
+    auto cos_max = std::sqrt(1 - radius_squared / centre_distance_squared);
+    return 1 / (2 * M_PI * (1 - cos_max));
+}
+
+} // namespace light_detail
+
+void light_list::add(const hittable_list& world) {
+    std::vector<const material*> unsampled;
+    collect(world, unsampled);
+
+    // A material is only skipped on hits if all of its emitters are sampled
+    auto is_unsampled = [&](const area_light& light) {
+        return std::find(unsampled.begin(), unsampled.end(), light.mat) !=
+               unsampled.end();
+    };
+    lights.erase(std::remove_if(lights.begin(), lights.end(), is_unsampled),
+                 lights.end());
+    sampled_materials.clear();
+    for (const auto& light : lights) {
+        if (!samples(light.mat)) {
+            sampled_materials.push_back(light.mat);
+        }
+    }
+
+    std::vector<light_bounds> bounds(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i) {
+        bounds[i] = light_detail::bounds(lights[i]);
+    }
+    tree = light_bvh(bounds);
+
+    std::vector<double> power(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i) {
+        power[i] = bounds[i].power;
+    }
+    by_power = alias_table(power);
+}
+
+void light_list::collect(const hittable_list& list,
+                         std::vector<const material*>& unsampled) {
+    auto is_light = [](const std::shared_ptr<material>& m) {
+        return dynamic_cast<const diffuse_light*>(m.get()) != nullptr;
+    };
+    auto single_material =
+        [](const hittable* p) -> const std::shared_ptr<material>* {
+        if (auto b = dynamic_cast<const box*>(p)) {
+            return &b->mat_ptr;
+        } else if (auto m = dynamic_cast<const moving_sphere*>(p)) {
+            return &m->mat_ptr;
+        } else if (auto pl = dynamic_cast<const plane*>(p)) {
+            return &pl->mat_ptr;
+        } else if (auto mesh = dynamic_cast<const triangle_mesh*>(p)) {
+            return &mesh->mat_ptr;
+        }
+        return nullptr;
+    };
+
+    for (const auto& object : list.objects) {
+        auto* p = object.get();
+        if (auto nested = dynamic_cast<const hittable_list*>(p)) {
+            collect(*nested, unsampled);
+        } else if (auto xy = dynamic_cast<const xy_rect*>(p)) {
+            if (is_light(xy->mp)) {
+                add_rect(point3(xy->x0, xy->y0, xy->k),
+                         vec3(xy->x1 - xy->x0, 0, 0),
+                         vec3(0, xy->y1 - xy->y0, 0), xy->mp.get());
+            }
+        } else if (auto xz = dynamic_cast<const xz_rect*>(p)) {
+            if (is_light(xz->mp)) {
+                add_rect(point3(xz->x0, xz->k, xz->z0),
+                         vec3(xz->x1 - xz->x0, 0, 0),
+                         vec3(0, 0, xz->z1 - xz->z0), xz->mp.get());
+            }
+        } else if (auto yz = dynamic_cast<const yz_rect*>(p)) {
+            if (is_light(yz->mp)) {
+                add_rect(point3(yz->k, yz->y0, yz->z0),
+                         vec3(0, yz->y1 - yz->y0, 0),
+                         vec3(0, 0, yz->z1 - yz->z0), yz->mp.get());
+            }
+        } else if (auto s = dynamic_cast<const sphere*>(p)) {
+            if (is_light(s->mat_ptr)) {
+                area_light light{};
+                light.type = area_light::shape::sphere;
+                light.centre = s->centre;
+                light.radius = s->radius;
+                light.area = 4 * M_PI * s->radius * s->radius;
+                light.mat = s->mat_ptr.get();
+                lights.push_back(light);
+            }
+        } else if (auto m = single_material(p)) {
+            // Emitters of other shapes are only found by chance, so their
+            // materials must always count emission
+            if (is_light(*m)) {
+                unsampled.push_back(m->get());
+            }
+        }
+    }
+}
+
+void light_list::add_rect(const point3& corner, const vec3& edge_u,
+                          const vec3& edge_v, const material* m) {
+    area_light light{};
+    light.type = area_light::shape::rect;
+    light.corner = corner;
+    light.edge_u = edge_u;
+    light.edge_v = edge_v;
+    light.area = cross(edge_u, edge_v).length();
+    light.mat = m;
+    // Rectangles with no area can never be hit either
+    if (light.area > 0) {
+        lights.push_back(light);
+    }
+}
+
+bool light_list::sample(const point3& from, const vec3& normal,
+                        light_sample& s) const {
+    auto sky_share = environment_share();
+    if (random_double() < sky_share) {
+        s.at_infinity = true;
+        if (!sky->sample(s.p, s.emitted, s.pdf)) {
+            return false;
+        }
+        s.pdf *= sky_share;
+        return true;
+    }
+
+    size_t choice;
+    double choice_pdf;
+    if (!tree.pick(from, normal, choice, choice_pdf)) {
+        return false;
+    }
+    choice_pdf *= 1 - sky_share;
+    const auto& light = lights[choice];
+    s.at_infinity = false;
+
+    if (light.type == area_light::shape::rect) {
+        auto u = random_double();
+        auto v = random_double();
+        s.p = light.corner + u * light.edge_u + v * light.edge_v;
+        s.emitted = light.mat->emitted(u, v, s.p);
+        s.pdf = choice_pdf * light_detail::solid_angle_pdf(light, from, s.p);
+        return s.pdf > 0;
+    }
+
+    // Spheres are sampled over the cone of directions they fill, which is
+    // all of them that can be seen
+    auto to_centre = light.centre - from;
+    auto distance_squared = to_centre.length_squared();
+    auto radius_squared = light.radius * light.radius;
+    if (distance_squared <= radius_squared) {
+        return false; // Inside the light, which is lit by bouncing instead
+    }
+    auto distance = std::sqrt(distance_squared);
+    auto cos_max = std::sqrt(1 - radius_squared / distance_squared);
+    auto cos_theta = 1 - random_double() * (1 - cos_max);
+    auto sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+    auto phi = 2 * M_PI * random_double();
+
+    auto w = to_centre / distance;
+    auto helper = std::fabs(w.x()) > 0.9 ? vec3{0, 1, 0} : vec3{1, 0, 0};
+    auto a = unit_vector(cross(w, helper));
+    auto b = cross(w, a);
+    auto direction = sin_theta * std::cos(phi) * a +
+                     sin_theta * std::sin(phi) * b + cos_theta * w;
+
+    // Nearest point of the sphere along the direction
+    auto along = dot(direction, to_centre);
+    auto miss = distance_squared - along * along;
+    auto t = along - std::sqrt(std::fmax(0.0, radius_squared - miss));
+    s.p = from + t * direction;
+
+    double u, v;
+    get_sphere_uv((s.p - light.centre) / light.radius, u, v);
+    s.emitted = light.mat->emitted(u, v, s.p);
+    s.pdf = choice_pdf * light_detail::solid_angle_pdf(light, from, s.p);
+    return s.pdf > 0 && s.pdf < infinity;
+}
+
+double light_list::pdf(const path_vertex& from, const hit_record& rec) const {
+    // Any of the lights with this material could be the one hit
+    double sum = 0;
+    tree.for_each_containing(
+        from.p, from.normal, rec.p, [&](size_t i, double choice_pdf) {
+            const auto& light = lights[i];
+            if (light.mat == rec.mat_ptr &&
+                light_detail::contains(light, rec.p)) {
+                sum += choice_pdf *
+                       light_detail::solid_angle_pdf(light, from.p, rec.p);
+            }
+        });
+    return (1 - environment_share()) * sum;
+}
+
+bool light_list::sample_emission(emission_sample& e) const {
+    if (by_power.empty()) {
+        return false;
+    }
+    auto choice = by_power.sample(random_double());
+    const auto& light = lights[choice];
+    e.pdf_position = by_power.pmf[choice] / light.area;
+
+    double u, v;
+    if (light.type == area_light::shape::rect) {
+        u = random_double();
+        v = random_double();
+        e.p = light.corner + u * light.edge_u + v * light.edge_v;
+        e.normal = cross(light.edge_u, light.edge_v) / light.area;
+        e.two_sided = true;
+    } else {
+        e.normal = lambertian_unit_vector();
+        e.p = light.centre + light.radius * e.normal;
+        get_sphere_uv(e.normal, u, v);
+        e.two_sided = false;
+    }
+    e.emitted = light.mat->emitted(u, v, e.p);
+
+    // Either side of a rectangle is as likely
+    auto side = e.normal;
+    if (e.two_sided && random_double() < 0.5) {
+        side = -side;
+    }
+    e.direction = side + lambertian_unit_vector();
+    if (e.direction.length_squared() < 1e-12) {
+        e.direction = side;
+    }
+    e.direction = unit_vector(e.direction);
+    e.pdf_direction =
+        dot(side, e.direction) / (e.two_sided ? 2 * M_PI : M_PI);
+    return e.pdf_position > 0 && e.pdf_direction > 0;
+}
+
+double light_list::emission_pdf_position(const material* m,
+                                         const point3& p) const {
+    if (by_power.empty()) {
+        return 0;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < lights.size(); ++i) {
+        if (lights[i].mat == m && light_detail::contains(lights[i], p)) {
+            sum += by_power.pmf[i] / lights[i].area;
+        }
+    }
+    return sum;
+}
+
+double light_list::emission_pdf_direction(const material* m, const point3& p,
+                                          const vec3& direction) const {
+    for (const auto& light : lights) {
+        if (light.mat != m || !light_detail::contains(light, p)) {
+            continue;
+        }
+        if (light.type == area_light::shape::rect) {
+            auto normal = cross(light.edge_u, light.edge_v) / light.area;
+            return std::fabs(dot(normal, direction)) / (2 * M_PI);
+        }
+        auto normal = (p - light.centre) / light.radius;
+        return std::fmax(0.0, dot(normal, direction)) / M_PI;
+    }
+    return 0;
+}
+
+template <typename pdf_function>
+colour3 light_list::direct_light(const ray& r, const hit_record& rec,
+                                 const hittable& world,
+                                 pdf_function&& bounce_pdf) const {
+    light_sample s;
+    if (!sample(rec.p, rec.normal, s)) {
+        return colour3{0, 0, 0};
+    }
+
+    vec3 direction;
+    hit_query query;
+    if (s.at_infinity) {
+        direction = s.p;
+        if (dot(direction, rec.normal) <= 0) {
+            return colour3{0, 0, 0};
+        }
+        ray shadow(offset_ray_origin(rec, direction), direction, r.time());
+        if (world.intersect(shadow, 0, infinity, query)) {
+            return colour3{0, 0, 0};
+        }
+    } else {
+        auto origin = offset_ray_origin(rec, s.p - rec.p);
+        auto to_light = s.p - origin;
+        auto distance = to_light.length();
+        direction = to_light / distance;
+        if (dot(direction, rec.normal) <= 0) {
+            return colour3{0, 0, 0};
+        }
+
+        // Stop just short of the light, so it does not shadow itself
+        ray shadow(origin, to_light, r.time());
+        if (world.intersect(shadow, 0, 1 - EPSILON / distance, query)) {
+            return colour3{0, 0, 0};
+        }
+    }
+
+    auto weight = power_heuristic(s.pdf, bounce_pdf(direction));
+    return rec.mat_ptr->eval(r, rec, direction) * s.emitted * (weight / s.pdf);
+}
+
+#endif
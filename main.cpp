@@ -1,86 +1,278 @@
 #include "utils.hpp"
 
 #include "aarect.hpp"
+#include "bidirectional.hpp"
+#include "box.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
 #include "colour3.hpp"
+#include "environment.hpp"
 #include "hittable_list.hpp"
+#include "kd_tree.hpp"
+#include "lights.hpp"
 #include "material.hpp"
+#include "material_table.hpp"
+#include "mesh_loader.hpp"
+#include "motion_bvh.hpp"
 #include "moving_sphere.hpp"
+#include "path_guide.hpp"
+#include "photon_mapping.hpp"
+#include "plane.hpp"
+#include "primitive_bvh.hpp"
+#include "radiance_cache.hpp"
+#include "rect_batch.hpp"
+#include "scene_arena.hpp"
+#include "scene_generator.hpp"
 #include "sphere.hpp"
+#include "sphere_batch.hpp"
 #include "texture.hpp"
+#include "tile_traversal.hpp"
 #include "vec3.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <memory>
+#include <vector>
+
+// Acceleration structure the scene is wrapped in before rendering
+enum class accelerator { none, bvh, kd_tree, motion_bvh, primitive_bvh };
+
+enum class integrator { path, bidirectional, photon_mapping };
+
+// Whether paths past a diffuse bounce may end into a radiance cache, and if
+// so whether the image may be biased for speed
+enum class radiance_caching { off, preview, unbiased };
+
+std::shared_ptr<hittable> build_accelerator(hittable_list& objects,
+                                            accelerator type, double time0,
+                                            double time1) {
+    // Unbounded objects are tested first, which can only shorten the search
+    // of the acceleration structure
+    auto unbounded = take_unbounded(objects, time0, time1);
+    if (!unbounded.objects.empty()) {
+        if (!objects.objects.empty()) {
+            unbounded.add(build_accelerator(objects, type, time0, time1));
+        }
+        return std::make_shared<hittable_list>(unbounded);
+    }
 
-hittable_list cornell_box() {
+    switch (type) {
+    case accelerator::bvh:
+        return std::make_shared<bvh_node>(objects, time0, time1);
+    case accelerator::kd_tree:
+        return std::make_shared<kd_tree>(objects, time0, time1);
+    case accelerator::motion_bvh:
+        return std::make_shared<motion_bvh>(objects, time0, time1);
+    case accelerator::primitive_bvh:
+        return std::make_shared<primitive_bvh>(objects, time0, time1);
+    case accelerator::none:
+    default:
+        return std::make_shared<hittable_list>(
+            batch_rects(batch_spheres(objects)));
+    }
+}
+
+hittable_list cornell_box(scene_arena& arena) {
     hittable_list objects;
 
-    auto red = std::make_shared<lambertian>(colour3{0.65, 0.05, 0.05});
-    auto white = std::make_shared<lambertian>(colour3{0.73, 0.73, 0.73});
-    auto green = std::make_shared<lambertian>(colour3{0.12, 0.45, 0.15});
-    auto light = std::make_shared<diffuse_light>(colour3{15, 15, 15});
+    auto red = arena.make<lambertian>(colour3{0.65, 0.05, 0.05});
+    auto white = arena.make<lambertian>(colour3{0.73, 0.73, 0.73});
+    auto green = arena.make<lambertian>(colour3{0.12, 0.45, 0.15});
+    auto light = arena.make<diffuse_light>(colour3{15, 15, 15});
 
     // Make Cornell box
-    objects.add(std::make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(std::make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(std::make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-    objects.add(std::make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(std::make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(std::make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+    objects.add(arena.make<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(arena.make<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(arena.make<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(arena.make<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(arena.make<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(arena.make<xy_rect>(0, 555, 0, 555, 555, white));
+
+    // Blocks
+    objects.add(
+        arena.make<box>(point3{130, 0, 65}, point3{295, 165, 230}, white));
+    objects.add(
+        arena.make<box>(point3{265, 0, 295}, point3{430, 330, 460}, white));
+
+    return objects;
+}
+
+// The Cornell box with its light sealed behind a pane of glass, which
+// shadow rays cannot pass
+hittable_list covered_light(scene_arena& arena) {
+    auto objects = cornell_box(arena);
+    auto glass = arena.make<dielectric>(1.5);
+    objects.add(
+        arena.make<box>(point3{193, 535, 207}, point3{363, 550, 352}, glass));
+    return objects;
+}
+
+// The Cornell box's walls and light, with glass spheres casting caustics
+hittable_list glass_caustics(scene_arena& arena) {
+    hittable_list objects;
+
+    auto red = arena.make<lambertian>(colour3{0.65, 0.05, 0.05});
+    auto white = arena.make<lambertian>(colour3{0.73, 0.73, 0.73});
+    auto green = arena.make<lambertian>(colour3{0.12, 0.45, 0.15});
+    auto light = arena.make<diffuse_light>(colour3{40, 40, 40});
+    auto glass = arena.make<dielectric>(1.5);
+
+    objects.add(arena.make<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(arena.make<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(arena.make<xz_rect>(238, 318, 250, 310, 554, light));
+    objects.add(arena.make<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(arena.make<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(arena.make<xy_rect>(0, 555, 0, 555, 555, white));
+
+    objects.add(arena.make<sphere>(point3{190, 100, 190}, 100, glass));
+    objects.add(arena.make<sphere>(point3{400, 70, 350}, 70, glass));
 
     return objects;
 }
 
-hittable_list simple_light() {
+// Two rooms joined by a doorway, with the only light in the far one
+hittable_list hidden_light(scene_arena& arena) {
     hittable_list objects;
 
-    auto perlin_tex = std::make_shared<noise_texture>(4);
+    auto white = arena.make<lambertian>(colour3{0.73, 0.73, 0.73});
+    auto red = arena.make<lambertian>(colour3{0.65, 0.05, 0.05});
+    auto light = arena.make<diffuse_light>(colour3{15, 15, 15});
+
+    // Walls, floor and ceiling
+    objects.add(arena.make<yz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(arena.make<yz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(arena.make<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(arena.make<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(arena.make<xy_rect>(0, 555, 0, 555, 555, white));
+
+    // Partition with a doorway low down, and the far room's front wall
+    objects.add(arena.make<yz_rect>(0, 555, 0, 190, 350, white));
+    objects.add(arena.make<yz_rect>(0, 555, 260, 555, 350, white));
+    objects.add(arena.make<yz_rect>(120, 555, 190, 260, 350, white));
+    objects.add(arena.make<xy_rect>(350, 555, 0, 555, 0, white));
+
+    objects.add(arena.make<xz_rect>(400, 520, 200, 350, 554, light));
+    objects.add(
+        arena.make<box>(point3{80, 0, 250}, point3{230, 200, 400}, red));
+
+    return objects;
+}
+
+hittable_list simple_light(scene_arena& arena) {
+    hittable_list objects;
+
+    auto perlin_tex = arena.make<noise_texture>(4);
     // Make "floor"
-    objects.add(std::make_shared<sphere>(
-        point3{0, -1000, 0}, 1000, std::make_shared<lambertian>(perlin_tex)));
+    objects.add(arena.make<plane>(point3{0, 0, 0}, vec3{0, 1, 0},
+                                  arena.make<lambertian>(perlin_tex)));
     // Make main sphere
-    objects.add(std::make_shared<sphere>(
-        point3{0, 2, 0}, 2, std::make_shared<lambertian>(perlin_tex)));
+    objects.add(arena.make<sphere>(
+        point3{0, 2, 0}, 2, arena.make<lambertian>(perlin_tex)));
 
-    auto diff_light = std::make_shared<diffuse_light>(colour3{4, 4, 4});
-    // objects.add(std::make_shared<xy_rect>(3, 5, 1, 3, -2, diff_light));
-    // objects.add(std::make_shared<xy_rect>(3, 5, 1, 3, -2, diff_light));
-    objects.add(std::make_shared<yz_rect>(-3, -3, -3, 3, -2, diff_light));
+    auto diff_light = arena.make<diffuse_light>(colour3{4, 4, 4});
+    // objects.add(arena.make<xy_rect>(3, 5, 1, 3, -2, diff_light));
+    // objects.add(arena.make<xy_rect>(3, 5, 1, 3, -2, diff_light));
+    objects.add(arena.make<yz_rect>(-3, -3, -3, 3, -2, diff_light));
 
-    objects.add(std::make_shared<sphere>(point3{0, 8, 0}, 2, diff_light));
+    objects.add(arena.make<sphere>(point3{0, 8, 0}, 2, diff_light));
 
     return objects;
 }
 
-hittable_list earth() {
-    auto earth_texture = std::make_shared<image_texture>("./img/earthmap.jpg");
-    auto earth_surface = std::make_shared<lambertian>(earth_texture);
-    auto globe = std::make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+hittable_list earth(scene_arena& arena) {
+    auto earth_texture = arena.make<image_texture>("./img/earthmap.jpg");
+    auto earth_surface = arena.make<lambertian>(earth_texture);
+    auto globe = arena.make<sphere>(point3(0, 0, 0), 2, earth_surface);
 
     return hittable_list(globe);
 }
 
-hittable_list two_perlin_spheres() {
+hittable_list scanned_mesh(scene_arena& arena) {
+    auto grey = arena.make<lambertian>(colour3{0.73, 0.73, 0.73});
+    auto mesh = load_mesh("./models/scan.ply", grey);
+    if (!mesh) {
+        return hittable_list{};
+    }
+
+    return hittable_list(mesh);
+}
+
+// Stress scene of a million spheres on a ground
+hittable_list sphere_field(scene_arena& arena) {
+    sphere_field_options options;
+    options.count = 1000000;
+    // About one sphere per unit of ground, as in random_scene's grid
+    options.half_width = 0.5 * std::sqrt(double(options.count));
+
+    hittable_list world;
+    auto ground = arena.make<lambertian>(colour3{0.5, 0.5, 0.5});
+    world.add(arena.make<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground));
+    world.add(generate_sphere_field(options, arena));
+    return world;
+}
+
+// Lit only by an environment map
+hittable_list outdoor(scene_arena& arena) {
+    hittable_list world;
+    auto ground = arena.make<lambertian>(colour3{0.5, 0.5, 0.5});
+    world.add(arena.make<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground));
+    auto clay = arena.make<lambertian>(colour3(0.7, 0.3, 0.2));
+    auto chrome = arena.make<metal>(colour3(0.8, 0.8, 0.8), 0.1);
+    auto glass = arena.make<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, clay));
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, chrome));
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, glass));
+    return world;
+}
+
+// A few objects among thousands of small lamps
+hittable_list night_lights(scene_arena& arena) {
+    hittable_list world;
+    auto ground = arena.make<lambertian>(colour3{0.5, 0.5, 0.5});
+    world.add(arena.make<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground));
+    auto chrome = arena.make<metal>(colour3(0.8, 0.8, 0.8), 0.2);
+    auto brown = arena.make<lambertian>(colour3(0.4, 0.2, 0.1));
+    auto grey = arena.make<lambertian>(colour3(0.7, 0.7, 0.7));
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, chrome));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, brown));
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, grey));
+
+    std::vector<std::shared_ptr<material>> lamps;
+    for (int i = 0; i < 16; ++i) {
+        auto warmth = random_double();
+        lamps.push_back(arena.make<diffuse_light>(
+            colour3(8, 4 + 3 * warmth, 1 + 5 * warmth)));
+    }
+    for (int i = 0; i < 4000; ++i) {
+        point3 centre(random_double(-30, 30), random_double(0.3, 4),
+                      random_double(-30, 30));
+        world.add(arena.make<sphere>(centre, random_double(0.03, 0.08),
+                                     lamps[i % lamps.size()]));
+    }
+    return world;
+}
+
+hittable_list two_perlin_spheres(scene_arena& arena) {
     hittable_list objects;
 
-    auto pertext = std::make_shared<noise_texture>(4);
-    objects.add(std::make_shared<sphere>(
-        point3(0, -1000, 0), 1000, std::make_shared<lambertian>(pertext)));
-    objects.add(std::make_shared<sphere>(
-        point3(0, 2, 0), 2, std::make_shared<lambertian>(pertext)));
+    auto pertext = arena.make<noise_texture>(4);
+    objects.add(arena.make<plane>(point3(0, 0, 0), vec3(0, 1, 0),
+                                  arena.make<lambertian>(pertext)));
+    objects.add(arena.make<sphere>(
+        point3(0, 2, 0), 2, arena.make<lambertian>(pertext)));
 
     return objects;
 }
 
-hittable_list random_scene() {
+hittable_list random_scene(scene_arena& arena) {
     hittable_list world;
 
-    auto checker = std::make_shared<checker_texture>(colour3(0.2, 0.3, 0.1),
-                                                     colour3(0.9, 0.9, 0.9));
-    auto ground_material = std::make_shared<lambertian>(checker);
+    auto checker = arena.make<checker_texture>(colour3(0.2, 0.3, 0.1),
+                                               colour3(0.9, 0.9, 0.9));
+    auto ground_material = arena.make<lambertian>(checker);
     world.add(
-        std::make_shared<sphere>(point3(0, -1000.5, 0), 1000, ground_material));
+        arena.make<plane>(point3(0, -0.5, 0), vec3(0, 1, 0), ground_material));
 
     // Draw 484 small spheres approximating a grid
     // for (int j = -11; j < 11; ++j) {
@@ -98,26 +290,26 @@ hittable_list random_scene() {
     //                     colour3::random() *
     //                     colour3::random(); // What does this do to the
     //                                        // probability distributions
-    //                 sphere_material = std::make_shared<lambertian>(albedo);
+    //                 sphere_material = arena.make<lambertian>(albedo);
 
     //                 auto end_point = sphere_centre + vec3(0, random_double(0,
     //                 0.5), 0);
 
-    //                 // world.add(std::make_shared<sphere>(sphere_centre, 0.2,
+    //                 // world.add(arena.make<sphere>(sphere_centre, 0.2,
     //                 //                                    sphere_material));
-    //                 world.add(std::make_shared<moving_sphere>(sphere_centre,
+    //                 world.add(arena.make<moving_sphere>(sphere_centre,
     //                 end_point, 0.0, 1.0, 0.2, sphere_material));
     //             } else if (material_distribution < 0.95) {
     //                 // Metal
     //                 auto albedo = colour3::random(0.5, 1);
     //                 auto fuzz = random_double(0, 0.5);
-    //                 sphere_material = std::make_shared<metal>(albedo, fuzz);
-    //                 world.add(std::make_shared<sphere>(sphere_centre, 0.2,
+    //                 sphere_material = arena.make<metal>(albedo, fuzz);
+    //                 world.add(arena.make<sphere>(sphere_centre, 0.2,
     //                                                    sphere_material));
     //             } else {
     //                 // Glass
-    //                 sphere_material = std::make_shared<dielectric>(1.5);
-    //                 world.add(std::make_shared<sphere>(sphere_centre, 0.2,
+    //                 sphere_material = arena.make<dielectric>(1.5);
+    //                 world.add(arena.make<sphere>(sphere_centre, 0.2,
     //                                                    sphere_material));
     //             }
     //         }
@@ -125,34 +317,144 @@ hittable_list random_scene() {
     // }
 
     // Draw big spheres
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3{0, 1, 0}, 1.0, material1));
+    auto material1 = arena.make<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3{0, 1, 0}, 1.0, material1));
 
-    auto material2 = std::make_shared<lambertian>(colour3{0.4, 0.2, 0.1});
-    world.add(std::make_shared<sphere>(point3{-4, 1, 0}, 1.0, material2));
+    auto material2 = arena.make<lambertian>(colour3{0.4, 0.2, 0.1});
+    world.add(arena.make<sphere>(point3{-4, 1, 0}, 1.0, material2));
 
-    auto material3 = std::make_shared<metal>(colour3{0.7, 0.6, 0.5}, 0.0);
-    world.add(std::make_shared<sphere>(point3{4, 1, 0}, 1.0, material3));
+    auto material3 = arena.make<metal>(colour3{0.7, 0.6, 0.5}, 0.0);
+    world.add(arena.make<sphere>(point3{4, 1, 0}, 1.0, material3));
 
     return world;
 }
 
-hittable_list two_spheres() {
+hittable_list two_spheres(scene_arena& arena) {
     hittable_list objects;
 
-    auto checker = std::make_shared<checker_texture>(colour3{0.2, 0.3, 0.1},
-                                                     colour3{0.9, 0.9, 0.9});
+    auto checker = arena.make<checker_texture>(colour3{0.2, 0.3, 0.1},
+                                               colour3{0.9, 0.9, 0.9});
 
-    objects.add(std::make_shared<sphere>(
-        point3(0, -10, 0), 10, std::make_shared<lambertian>(checker)));
-    objects.add(std::make_shared<sphere>(
-        point3(0, 10, 0), 10, std::make_shared<lambertian>(checker)));
+    objects.add(arena.make<sphere>(
+        point3(0, -10, 0), 10, arena.make<lambertian>(checker)));
+    objects.add(arena.make<sphere>(
+        point3(0, 10, 0), 10, arena.make<lambertian>(checker)));
 
     return objects;
 }
 
-colour3 ray_colour(const ray& r, const colour3& background,
-                   const hittable& world, int bounces_remaining) {
+colour3 ray_colour(const ray& r, const environment& background,
+                   const hittable& world, const light_list& lights,
+                   const material_table& materials, path_guide& guide,
+                   radiance_cache& cache, int bounces_remaining,
+                   const path_vertex& previous, int diffuse_bounces);
+
+/**
+ * @brief Colour leaving the surface at rec back along r
+ *
+ * @param previous The surface r left, if the lights were sampled there, in
+ * which case emission found here is weighted against that light sample
+ * @param diffuse_bounces Bounces the path has made off cached surfaces,
+ * past the first of which it may end into the cache
+ */
+colour3 surface_colour(const ray& r, const hit_record& rec,
+                       const environment& background, const hittable& world,
+                       const light_list& lights,
+                       const material_table& materials, path_guide& guide,
+                       radiance_cache& cache, int bounces_remaining,
+                       const path_vertex& previous = path_vertex{},
+                       int diffuse_bounces = 0) {
+    ray scattered; // New ray generated
+    colour3 attenuation;
+    colour3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    if (previous.pdf > 0 && lights.samples(rec.mat_ptr)) {
+        emitted *=
+            power_heuristic(previous.pdf, lights.pdf(previous, rec));
+    }
+
+    // Guided bounces are mixed with the material's own, and both are
+    // weighted by the density of the mixture
+    auto guided = guide.guides(rec.mat_ptr);
+    auto region = 0u;
+    if (guided || guide.records(rec.mat_ptr)) {
+        region = guide.region(rec.p);
+    }
+    auto bounce_pdf = [&](const vec3& direction) {
+        auto pdf = rec.mat_ptr->scattering_pdf(r, rec, direction);
+        if (guided) {
+            pdf = guide.share * guide.pdf(region, direction) +
+                  (1 - guide.share) * pdf;
+        }
+        return pdf;
+    };
+
+    // Lights are sampled even where the material's own sample is absorbed
+    auto sample_lights = rec.mat_ptr->samples_lights() && !lights.empty();
+    colour3 direct{0, 0, 0};
+    if (sample_lights) {
+        direct = lights.direct_light(r, rec, world, bounce_pdf);
+    }
+
+    if (guided && random_double() < guide.share) {
+        auto direction = guide.sample(region);
+        scattered = ray(offset_ray_origin(rec, direction), direction, r.time());
+    } else if (!materials.scatter(r, rec, attenuation, scattered)) {
+        return emitted + direct;
+    }
+
+    // Light arriving here may be taken from the cache, for all but the
+    // paths traced on to keep its cells learning, or the image unbiased.
+    // Unbiased paths look up only once, as each correction below multiplies
+    // the spread of the ones before it.
+    auto cached = !guided && cache.caches(materials, rec.mat_ptr);
+    auto looks_up = cached && diffuse_bounces >= 1 &&
+                    (!cache.unbiased || diffuse_bounces == 1);
+    colour3 arriving;
+    auto warm = looks_up && cache.lookup(cache.lookup_cell(rec.p, rec.normal),
+                                         arriving);
+    if (warm && random_double() >= cache.trace_share) {
+        return emitted + direct + attenuation * arriving;
+    }
+
+    auto direction = unit_vector(scattered.direction());
+    double pdf = 0;
+    if (sample_lights || guided || guide.records(rec.mat_ptr)) {
+        pdf = bounce_pdf(direction);
+    }
+    if (guided) {
+        if (!(pdf > 0)) {
+            return emitted + direct;
+        }
+        attenuation = rec.mat_ptr->eval(r, rec, direction) / pdf;
+    }
+
+    path_vertex here;
+    if (sample_lights) {
+        here.p = rec.p;
+        here.normal = rec.normal;
+        here.pdf = pdf;
+    }
+
+    auto incoming = ray_colour(scattered, background, world, lights, materials,
+                               guide, cache, bounces_remaining - 1, here,
+                               diffuse_bounces + cached);
+    if (pdf > 0 && guide.records(rec.mat_ptr)) {
+        guide.record(region, direction, incoming, pdf);
+    }
+    if (cached) {
+        cache.record(cache.cell(rec.p, rec.normal, true), incoming);
+        if (warm && cache.unbiased) {
+            incoming = arriving + (incoming - arriving) / cache.trace_share;
+        }
+    }
+    return emitted + direct + attenuation * incoming;
+}
+
+colour3 ray_colour(const ray& r, const environment& background,
+                   const hittable& world, const light_list& lights,
+                   const material_table& materials, path_guide& guide,
+                   radiance_cache& cache, int bounces_remaining,
+                   const path_vertex& previous, int diffuse_bounces) {
     // Can't bounce anymore!
     if (bounces_remaining <= 0) {
         return colour3(0, 0, 0);
@@ -160,20 +462,18 @@ colour3 ray_colour(const ray& r, const colour3& background,
 
     hit_record rec;
 
-    if (!world.hit(r, EPSILON, infinity, rec)) {
-        return background;
-    }
-
-    ray scattered; // New ray generated
-    colour3 attenuation;
-    colour3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-        return emitted;
+    if (!world.hit(r, 0, infinity, rec)) {
+        auto sky = background.value(r.direction());
+        if (previous.pdf > 0 && lights.samples_environment()) {
+            sky *= power_heuristic(
+                previous.pdf,
+                lights.environment_pdf(unit_vector(r.direction())));
+        }
+        return sky;
     }
 
-    return emitted + attenuation * ray_colour(scattered, background, world,
-                                              bounces_remaining - 1);
+    return surface_colour(r, rec, background, world, lights, materials, guide,
+                          cache, bounces_remaining, previous, diffuse_bounces);
 }
 
 // Generates an image in PPM Image Format
@@ -190,53 +490,140 @@ int main() {
 
     // World
 
+    // Owns the scene's objects, so is declared first to be destroyed last
+    scene_arena arena;
     hittable_list world;
     point3 look_from;
     point3 look_to;
     auto fov = 40.0;
     auto aperture = 0.0;
-    colour3 background{0, 0, 0};
+    environment background{colour3{0, 0, 0}};
+    auto accel = accelerator::bvh;
+    auto guide_paths = false;
+    auto method = integrator::path;
+    auto photon_radius = 5.0; // Gather radius photon mapping starts from
+    auto caching = radiance_caching::off;
 
     switch (0) {
     case 1:
-        world = random_scene();
+        world = random_scene(arena);
         background = colour3{0.7, 0.8, 1.0};
         look_from = point3(13, 2, 3);
         fov = 20.0;
         aperture = 0.1;
         break;
     case 2:
-        world = two_spheres();
+        world = two_spheres(arena);
         background = colour3{0.7, 0.8, 1.0};
         look_from = point3(13, 2, 3);
         look_to = point3(0, 0, 0);
         fov = 20.0;
         break;
     case 3:
-        world = two_perlin_spheres();
+        world = two_perlin_spheres(arena);
         background = colour3{0.7, 0.8, 1.0};
         look_from = point3(13, 2, 3);
         look_to = point3(0, 0, 0);
         fov = 20.0;
         break;
     case 4:
-        world = earth();
+        world = earth(arena);
         background = colour3{0.7, 0.8, 1.0};
         look_from = point3(13, 2, 3);
         look_to = point3(0, 0, 0);
         fov = 20.0;
         break;
     case 5:
-        world = simple_light();
+        world = simple_light(arena);
         background = colour3{0., 0., 0.};
         samples_per_pixel = 400;
         look_from = point3{26, 3, 6};
         look_to = point3{0, 2, 0};
         fov = 20.;
         break;
+    case 7: {
+        world = scanned_mesh(arena);
+        background = colour3{0.7, 0.8, 1.0};
+        // Frame whatever was loaded
+        aabb box;
+        if (world.bounding_box(0, 0, box)) {
+            look_to = 0.5 * (box.min() + box.max());
+            look_from =
+                look_to + vec3(0, 0, 1.5 * (box.max() - box.min()).length());
+        }
+        fov = 40.0;
+        break;
+    }
+    case 8:
+        world = sphere_field(arena);
+        background = colour3{0.7, 0.8, 1.0};
+        look_from = point3(13, 2, 3);
+        look_to = point3(0, 0, 0);
+        fov = 20.0;
+        // The spheres come with their own BVH
+        accel = accelerator::none;
+        break;
+    case 9:
+        world = night_lights(arena);
+        look_from = point3(13, 2, 3);
+        look_to = point3(0, 0.5, 0);
+        fov = 30.0;
+        break;
+    case 10:
+        world = outdoor(arena);
+        background = environment("./img/sky.hdr");
+        look_from = point3(13, 2, 3);
+        look_to = point3(0, 1, 0);
+        fov = 25.0;
+        break;
+    case 11:
+        world = hidden_light(arena);
+        aspect_ratio = 1.0;
+        image_width = 300;
+        samples_per_pixel = 200;
+        look_from = point3{278, 278, -800};
+        look_to = point3{278, 278, 0};
+        fov = 40.0;
+        accel = accelerator::kd_tree;
+        guide_paths = true;
+        break;
+    case 12:
+        world = covered_light(arena);
+        aspect_ratio = 1.0;
+        image_width = 300;
+        samples_per_pixel = 200;
+        look_from = point3{278, 278, -800};
+        look_to = point3{278, 278, 0};
+        fov = 40.0;
+        accel = accelerator::kd_tree;
+        method = integrator::bidirectional;
+        break;
+    case 13:
+        world = glass_caustics(arena);
+        aspect_ratio = 1.0;
+        image_width = 300;
+        samples_per_pixel = 200;
+        look_from = point3{278, 278, -800};
+        look_to = point3{278, 278, 0};
+        fov = 40.0;
+        accel = accelerator::kd_tree;
+        method = integrator::photon_mapping;
+        photon_radius = 4.0;
+        break;
+    case 14:
+        world = cornell_box(arena);
+        aspect_ratio = 1.0;
+        image_width = 300;
+        samples_per_pixel = 200;
+        look_from = point3{278, 278, -800};
+        look_to = point3{278, 278, 0};
+        fov = 40.0;
+        accel = accelerator::kd_tree;
+        caching = radiance_caching::preview;
+        break;
     case 6:
     default:
-        world = cornell_box();
+        world = cornell_box(arena);
         aspect_ratio = 1.0;
         image_width = 300;
         samples_per_pixel = 200;
@@ -244,6 +631,7 @@ int main() {
         look_from = point3{278, 278, -800};
         look_to = point3{278, 278, 0};
         fov = 40.0;
+        accel = accelerator::kd_tree;
         break;
     }
 
@@ -251,28 +639,139 @@ int main() {
     vec3 UP{0, 1, 0};
     auto dist_to_focus = 10.0;
     int image_height = static_cast<int>(image_width / aspect_ratio);
+    auto shutter_open = 0.0;
+    auto shutter_close = 0.0;
+
+    camera cam{look_from,     look_to,      UP,
+               fov,           aspect_ratio, aperture,
+               dist_to_focus, shutter_open, shutter_close};
+
+    // Emitters to sample directly, found before the scene is rearranged
+    light_list lights(world, &background);
+    // Packs the materials for scattering without virtual calls
+    material_table materials(arena);
+
+    // Learns where light comes from over the first passes, for scenes whose
+    // objects are all bounded
+    path_guide guide;
+    aabb scene_bounds;
+    if (guide_paths &&
+        world.bounding_box(shutter_open, shutter_close, scene_bounds)) {
+        guide = path_guide(scene_bounds);
+    }
+
+    // Learns the light arriving at diffuse surfaces as the render goes, for
+    // paths to end into
+    radiance_cache cache;
+    if (caching != radiance_caching::off &&
+        world.bounding_box(shutter_open, shutter_close, scene_bounds)) {
+        cache = radiance_cache(scene_bounds);
+        if (caching == radiance_caching::unbiased) {
+            // Paths traced on are weighted by 1 / trace_share, so trace
+            // more of them to keep their spread down
+            cache.unbiased = true;
+            cache.trace_share = 0.5;
+        }
+    }
 
-    camera cam{look_from, look_to,       UP,  fov, aspect_ratio,
-               aperture,  dist_to_focus, 0.0, 0.0};
+    // Acceleration structure
+    auto build_start = std::chrono::steady_clock::now();
+    auto scene = build_accelerator(world, accel, shutter_open, shutter_close);
+    std::chrono::duration<double> build_time =
+        std::chrono::steady_clock::now() - build_start;
+    std::cerr << "Built acceleration structure in " << build_time.count()
+              << " s\n";
 
     // Render
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    auto render_start = std::chrono::steady_clock::now();
+    std::vector<colour3> image(image_width * image_height);
+    // Light that bidirectional paths send to other pixels than their own
+    splat_film splats(image_width, image_height);
+    bidirectional_tracer bidirectional(*scene, lights, materials, cam,
+                                       background, splats, max_bounces);
+    const int tile_size = 16;
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+    // While the guide learns, passes double in length and each is followed
+    // by refining it. The last pass takes whatever samples remain, which
+    // without a guide is all of them.
+    int samples_done = 0;
+    if (method == integrator::photon_mapping) {
+        // Renders every sample at once, each a pass of camera paths and
+        // photons
+        photon_mapper photons(*scene, lights, materials, cam, background,
+                              image_width, image_height, max_bounces,
+                              photon_radius, 0, shutter_open, shutter_close);
+        photons.render(image, samples_per_pixel);
+        samples_done = samples_per_pixel;
+    }
+    for (int pass = 0; samples_done < samples_per_pixel; ++pass) {
+        auto remaining = samples_per_pixel - samples_done;
+        guide.learning = guide.enabled() && (3 << pass) <= remaining;
+        int pass_samples = guide.learning ? 1 << pass : remaining;
+
+        for (int tile = 0; tile < tiles_x * tiles_y; ++tile) {
+            std::cerr << "\rTiles remaining: " << tiles_x * tiles_y - tile
+                      << ' ' << std::flush;
+            int i0 = (tile % tiles_x) * tile_size;
+            int j0 = (tile / tiles_x) * tile_size;
+            int i1 = std::min(i0 + tile_size, image_width);
+            int j1 = std::min(j0 + tile_size, image_height);
+
+            // Camera rays in this tile only need to search the parts of the
+            // scene their bundle can reach
+            auto bundle = cam.get_ray_bundle(double(i0) / (image_width - 1),
+                                             double(i1) / (image_width - 1),
+                                             double(j0) / (image_height - 1),
+                                             double(j1) / (image_height - 1));
+            auto entry_points =
+                tile_entry_points(scene, bundle, shutter_open, shutter_close);
+
+            for (int j = j0; j < j1; ++j) {
+                for (int i = i0; i < i1; ++i) {
+                    colour3 pixel_colour{0, 0, 0};
+                    for (int s = 0; s < pass_samples; ++s) {
+                        auto u =
+                            double(i + random_double()) / (image_width - 1);
+                        auto v =
+                            double(j + random_double()) / (image_height - 1);
+                        ray r = cam.get_ray(u, v);
+
+                        hit_record rec;
+                        if (method == integrator::bidirectional) {
+                            pixel_colour += bidirectional.sample(r);
+                        } else if (entry_points.hit(r, 0, infinity, rec)) {
+                            pixel_colour += surface_colour(
+                                r, rec, background, *scene, lights, materials,
+                                guide, cache, max_bounces);
+                        } else {
+                            pixel_colour += background.value(r.direction());
+                        }
+                    }
+                    image[j * image_width + i] += pixel_colour;
+                }
+            }
+        }
+
+        samples_done += pass_samples;
+        if (guide.learning) {
+            guide.refine(pass);
+        }
+    }
 
+    splats.add_to(image);
+
+    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
     for (int j = image_height - 1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
         for (int i = 0; i < image_width; ++i) {
-            colour3 pixel_colour{0, 0, 0};
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = double(i + random_double()) / (image_width - 1);
-                auto v = double(j + random_double()) / (image_height - 1);
-                ray r = cam.get_ray(u, v);
-                pixel_colour += ray_colour(r, background, world, max_bounces);
-            }
-
-            write_colour(std::cout, pixel_colour, samples_per_pixel);
+            write_colour(std::cout, image[j * image_width + i],
+                         samples_per_pixel);
         }
     }
 
-    std::cerr << "\nDone.\n";
+    std::chrono::duration<double> render_time =
+        std::chrono::steady_clock::now() - render_start;
+    std::cerr << "\nDone in " << render_time.count() << " s.\n";
 }
\ No newline at end of file
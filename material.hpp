@@ -2,10 +2,13 @@
 #define MATERIAL_H
 
 #include "hittable.hpp"
+#include "material_kernels.hpp"
 #include "texture.hpp"
 #include "utils.hpp"
 #include "vec3.hpp"
 
+#include <cstdint>
+
 double schlick(double cosine, double ior);
 
 class material {
@@ -17,6 +20,28 @@ public:
 
     virtual bool scatter(const ray& r_in, const hit_record& rec,
                          colour3& attenuation, ray& scattered) const = 0;
+
+    // Whether light sources are sampled directly at hits on this material,
+    // which needs `eval` and `scattering_pdf`. Mirrors and glass scatter
+    // into single directions a light sample can never pick.
+    virtual bool samples_lights() const { return false; }
+
+    // Light scattered back along r_in per unit of light arriving along the
+    // unit vector direction, times the cosine to the normal
+    virtual colour3 eval(const ray& r_in, const hit_record& rec,
+                         const vec3& direction) const {
+        return colour3{0, 0, 0};
+    }
+
+    // Probability density per unit solid angle that `scatter` picks the unit
+    // vector direction, so attenuation = eval / scattering_pdf
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                  const vec3& direction) const {
+        return 0;
+    }
+
+    // Where a `material_table` packed this material, if one did
+    uint32_t table_entry = ~0u;
 };
 
 class lambertian : public material {
@@ -27,34 +52,69 @@ public:
     // Does scatter
     virtual bool scatter(const ray& r_in, const hit_record& rec,
                          colour3& attenuation, ray& scattered) const override {
-        // Returns a random unit vector with a lambertian distribution
-
-        vec3 scatter_direction = rec.normal + lambertian_unit_vector();
-        scattered = ray(rec.p, scatter_direction, r_in.time());
+        using namespace material_kernels;
+        auto scatter_direction = vec3_of(lambertian_direction(
+            lanes_of(rec.normal), lanes_of(lambertian_unit_vector())));
+        scattered = ray(offset_ray_origin(rec, scatter_direction),
+                        scatter_direction, r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    virtual bool samples_lights() const override { return true; }
+
+    virtual colour3 eval(const ray& r_in, const hit_record& rec,
+                         const vec3& direction) const override {
+        return albedo->value(rec.u, rec.v, rec.p) *
+               scattering_pdf(r_in, rec, direction);
+    }
+
+    // Cosine weighted
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                  const vec3& direction) const override {
+        auto cosine = dot(direction, rec.normal);
+        return cosine > 0 ? cosine / M_PI : 0;
+    }
+
 public:
     std::shared_ptr<texture> albedo;
 };
 
+/**
+ * @brief Conductor with a GGX microfacet surface
+ *
+ * Directions are drawn from the microfacet normals the viewer can see, so
+ * each sample's weight is just the Fresnel term times G2 / G1, and few
+ * leave below the surface. A fuzz of 0 is a perfect mirror.
+ */
 class metal : public material {
 public:
-    metal(const colour3& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const colour3& a, double f)
+        : albedo(a), fuzz(clamp(f, 0.0, 1.0)), alpha(fuzz / 2) {}
 
-    // Whether the reflected ray is outside of the surface
     virtual bool scatter(const ray& r_in, const hit_record& rec,
-                         colour3& attenuation, ray& scattered) const override {
-        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere());
-        attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
-    }
+                         colour3& attenuation, ray& scattered) const override;
+
+    // Only a rough surface spreads over a range of directions
+    virtual bool samples_lights() const override { return !is_mirror(); }
+
+    virtual colour3 eval(const ray& r_in, const hit_record& rec,
+                         const vec3& direction) const override;
+
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec,
+                                  const vec3& direction) const override;
 
 public:
-    colour3 albedo;
+    colour3 albedo; // Reflectance at normal incidence
+    // Spread of the reflection, roughly the half-angle of its lobe in
+    // radians as for the old fuzz ball
     double fuzz;
+    // GGX's roughness, whose reflections spread about twice as far
+    double alpha;
+
+private:
+    // Below this the lobe is too narrow to sample by its density
+    bool is_mirror() const { return alpha < 1e-3; }
 };
 
 class dielectric : public material {
@@ -63,25 +123,14 @@ public:
 
     virtual bool scatter(const ray& r_in, const hit_record& rec,
                          colour3& attenuation, ray& scattered) const override {
+        using namespace material_kernels;
         attenuation = colour3(1.0, 1.0, 1.0);
         double eta_i_over_eta_r = rec.front_face ? (1.0 / ior) : ior;
-
-        vec3 ray_hat =
-            unit_vector(r_in.direction()); // Ray propogation direction
-
-        double cos_theta = fmin(dot(-ray_hat, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
-        double reflect_prob = schlick(cos_theta, eta_i_over_eta_r);
-
-        if (eta_i_over_eta_r * sin_theta > 1.0 // Total Internal Reflection
-            || random_double() < reflect_prob  // Reflectivity of material
-        ) {
-            vec3 reflected = reflect(ray_hat, rec.normal);
-            scattered = ray(rec.p, reflected);
-            return true;
-        }
-        vec3 refracted = refract(ray_hat, rec.normal, eta_i_over_eta_r);
-        scattered = ray(rec.p, refracted);
+        auto direction = vec3_of(dielectric_direction(
+            lanes_of(unit_vector(r_in.direction())), lanes_of(rec.normal),
+            eta_i_over_eta_r, random_double()));
+        scattered =
+            ray(offset_ray_origin(rec, direction), direction, r_in.time());
         return true;
     }
 
@@ -125,6 +174,63 @@ public:
     std::shared_ptr<texture> emit;
 };
 
+bool metal::scatter(const ray& r_in, const hit_record& rec,
+                    colour3& attenuation, ray& scattered) const {
+    using namespace material_kernels;
+    auto disc = random_in_unit_disk();
+    lanes<double> direction;
+    auto weight = lanes_of(albedo);
+    // Rare at all but grazing angles, where the path would need to hit a
+    // second microfacet
+    if (!metal_scatter(lanes_of(-unit_vector(r_in.direction())),
+                       lanes_of(rec.normal), alpha, double(disc.x()),
+                       double(disc.y()), direction, weight)) {
+        return false;
+    }
+
+    auto d = vec3_of(direction);
+    scattered = ray(offset_ray_origin(rec, d), d, r_in.time());
+    attenuation = vec3_of(weight);
+    return true;
+}
+
+colour3 metal::eval(const ray& r_in, const hit_record& rec,
+                    const vec3& direction) const {
+    using namespace material_kernels;
+    auto wo = -unit_vector(r_in.direction());
+    double cos_o = dot(wo, rec.normal);
+    double cos_i = dot(direction, rec.normal);
+    if (is_mirror() || cos_o <= 0 || cos_i <= 0) {
+        return colour3{0, 0, 0};
+    }
+
+    auto h = unit_vector(wo + direction);
+    double cos_oh = dot(wo, h);
+    auto d = distribution<double>(dot(h, rec.normal), alpha);
+    auto g = masking_shadowing(cos_o, cos_i, alpha);
+    // D G F / (4 cos_o cos_i), times cos_i
+    return colour3(fresnel<double>(albedo.x(), cos_oh),
+                   fresnel<double>(albedo.y(), cos_oh),
+                   fresnel<double>(albedo.z(), cos_oh)) *
+           (d * g / (4 * cos_o));
+}
+
+// Visible normals have density G1 D max(0, wo.h) / cos_o, and reflecting
+// about them divides by 4 wo.h
+double metal::scattering_pdf(const ray& r_in, const hit_record& rec,
+                             const vec3& direction) const {
+    using namespace material_kernels;
+    auto wo = -unit_vector(r_in.direction());
+    double cos_o = dot(wo, rec.normal);
+    if (is_mirror() || cos_o <= 0 || dot(direction, rec.normal) <= 0) {
+        return 0;
+    }
+
+    auto h = unit_vector(wo + direction);
+    auto d = distribution<double>(dot(h, rec.normal), alpha);
+    return masking(cos_o, alpha) * d / (4 * cos_o);
+}
+
 // Uses the Schick approximation for a dielectric
 double schlick(double cosine, double ior) {
     auto r0 = (1 - ior) / (1 + ior);
@@ -0,0 +1,210 @@
+/**
+ * @file material_kernels.hpp
+ * @author @rjkilpatrick
+ * @brief Scattering maths written once for a single hit or a vector of them
+ *
+ * Each kernel is a template over its number type: `double` shades one hit,
+ * and `vdouble` from simd.hpp shades a SIMD vector of hits with the same
+ * code. Branches are written as masks and `select`, and random numbers are
+ * drawn by the caller, so nothing in a kernel depends on its lane.
+ *
+ */
+#ifndef MATERIAL_KERNELS_H
+#define MATERIAL_KERNELS_H
+
+#include "vec3.hpp"
+
+#include <cmath>
+
+namespace material_kernels {
+
+// Matches simd.hpp's `select` for a single lane
+inline double select(bool m, double a, double b) { return m ? a : b; }
+
+template <typename T> struct lanes {
+    T x, y, z;
+};
+
+template <typename T>
+inline lanes<T> operator+(const lanes<T>& a, const lanes<T>& b) {
+    return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+template <typename T>
+inline lanes<T> operator-(const lanes<T>& a, const lanes<T>& b) {
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+template <typename T> inline lanes<T> operator*(T t, const lanes<T>& a) {
+    return {t * a.x, t * a.y, t * a.z};
+}
+
+template <typename T> inline T dot(const lanes<T>& a, const lanes<T>& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename T>
+inline lanes<T> cross(const lanes<T>& a, const lanes<T>& b) {
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x};
+}
+
+template <typename T> inline lanes<T> normalise(const lanes<T>& a) {
+    return (T(1) / sqrt(dot(a, a))) * a;
+}
+
+template <typename T, typename M>
+inline lanes<T> select(M m, const lanes<T>& a, const lanes<T>& b) {
+    return {select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z)};
+}
+
+inline lanes<double> lanes_of(const vec3& v) { return {v.x(), v.y(), v.z()}; }
+
+inline vec3 vec3_of(const lanes<double>& v) { return vec3(v.x, v.y, v.z); }
+
+template <typename T> inline T clamp01(T x) {
+    return fmin(fmax(x, T(0)), T(1));
+}
+
+template <typename T> inline T pow5(T x) {
+    auto x2 = x * x;
+    return x2 * x2 * x;
+}
+
+// GGX distribution of normals at cos_h to the macro normal
+template <typename T> inline T distribution(T cos_h, T alpha) {
+    auto a2 = alpha * alpha;
+    auto d = cos_h * cos_h * (a2 - T(1)) + T(1);
+    return a2 / (T(M_PI) * d * d);
+}
+
+// Smith's Lambda for a direction above the surface, from which both
+// masking terms follow
+template <typename T> inline T lambda(T cosine, T alpha) {
+    auto cos2 = cosine * cosine;
+    auto tan2 = fmax(T(1) - cos2, T(0)) / cos2;
+    return (sqrt(T(1) + alpha * alpha * tan2) - T(1)) * T(0.5);
+}
+
+template <typename T> inline T masking(T cos_o, T alpha) {
+    return T(1) / (T(1) + lambda(cos_o, alpha));
+}
+
+// Height-correlated masking and shadowing
+template <typename T> inline T masking_shadowing(T cos_o, T cos_i, T alpha) {
+    return T(1) / (T(1) + lambda(cos_o, alpha) + lambda(cos_i, alpha));
+}
+
+// Schlick's approximation, from the reflectance at normal incidence
+template <typename T> inline T fresnel(T f0, T cosine) {
+    return f0 + (T(1) - f0) * pow5(T(1) - clamp01(cosine));
+}
+
+/**
+ * @brief Cosine-weighted scattering off a lambertian surface
+ *
+ * @param unit_random A uniformly random unit vector
+ */
+template <typename T>
+inline lanes<T> lambertian_direction(const lanes<T>& normal,
+                                     const lanes<T>& unit_random) {
+    return normal + unit_random;
+}
+
+/**
+ * @brief Reflection off a GGX conductor, about a normal the viewer can see,
+ * by Heitz's method
+ *
+ * @param wo Unit vector to the viewer
+ * @param disc_x, disc_y A uniformly random point in the unit disc
+ * @param attenuation Holds the reflectance at normal incidence on entry,
+ * and the sample's weight, F G2 / G1, on return
+ * @return Where the reflection leaves above the surface
+ */
+template <typename T>
+inline auto metal_scatter(const lanes<T>& wo, const lanes<T>& normal,
+                          T alpha, T disc_x, T disc_y, lanes<T>& direction,
+                          lanes<T>& attenuation) -> decltype(T() < T()) {
+    const lanes<T> x_axis{T(1), T(0), T(0)};
+    const lanes<T> y_axis{T(0), T(1), T(0)};
+
+    // Tangents to the normal
+    auto abs_x = fmax(normal.x, T(0) - normal.x);
+    auto helper = select(abs_x > T(0.9), y_axis, x_axis);
+    auto t = normalise(cross(helper, normal));
+    auto b = cross(normal, t);
+    auto cos_o = dot(wo, normal);
+    lanes<T> local_wo{dot(wo, t), dot(wo, b), cos_o};
+
+    // Stretch to the unit hemisphere, where the visible normals are a
+    // projected disc
+    auto v = normalise(lanes<T>{alpha * local_wo.x, alpha * local_wo.y,
+                                local_wo.z});
+    auto length_squared = v.x * v.x + v.y * v.y;
+    auto has_length = length_squared > T(0);
+    auto inverse_length =
+        T(1) / sqrt(select(has_length, length_squared, T(1)));
+    auto t1 = select(has_length,
+                     lanes<T>{(T(0) - v.y) * inverse_length,
+                              v.x * inverse_length, T(0)},
+                     x_axis);
+    auto t2 = cross(v, t1);
+    auto s = T(0.5) * (T(1) + v.z);
+    auto p1 = disc_x;
+    auto p2 = (T(1) - s) * sqrt(fmax(T(1) - p1 * p1, T(0))) + s * disc_y;
+    auto m = p1 * t1 + p2 * t2 +
+             sqrt(fmax(T(1) - p1 * p1 - p2 * p2, T(0))) * v;
+
+    // Unstretch, leaving a mirror's normal as it is
+    auto is_mirror = alpha < T(1e-3);
+    auto local_h = select(is_mirror, lanes<T>{T(0), T(0), T(1)},
+                          normalise(lanes<T>{alpha * m.x, alpha * m.y,
+                                             fmax(m.z, T(0))}));
+    auto h = local_h.x * t + local_h.y * b + local_h.z * normal;
+
+    auto cos_oh = dot(wo, h);
+    direction = (T(2) * cos_oh) * h - wo;
+    auto cos_i = dot(direction, normal);
+    auto alive = (cos_o > T(0)) & (cos_i > T(0));
+
+    // Keep dead lanes finite
+    auto safe_cos_o = select(alive, cos_o, T(1));
+    auto safe_cos_i = select(alive, cos_i, T(1));
+    auto weight = select(is_mirror, T(1),
+                         masking_shadowing(safe_cos_o, safe_cos_i, alpha) /
+                             masking(safe_cos_o, alpha));
+    attenuation = {fresnel(attenuation.x, cos_oh) * weight,
+                   fresnel(attenuation.y, cos_oh) * weight,
+                   fresnel(attenuation.z, cos_oh) * weight};
+    return alive;
+}
+
+/**
+ * @brief Reflection or refraction through a dielectric, chosen by Schlick's
+ * approximation
+ *
+ * @param incident Unit direction of the incoming ray
+ * @param eta Ratio of refractive indices, incident over transmitted
+ * @param u A uniformly random number in [0, 1)
+ */
+template <typename T>
+inline lanes<T> dielectric_direction(const lanes<T>& incident,
+                                     const lanes<T>& normal, T eta, T u) {
+    auto cos_theta = fmin(T(0) - dot(incident, normal), T(1));
+    auto sin_theta = sqrt(fmax(T(1) - cos_theta * cos_theta, T(0)));
+    auto r0 = (T(1) - eta) / (T(1) + eta);
+    r0 = r0 * r0;
+    auto reflect_probability = r0 + (T(1) - r0) * pow5(T(1) - cos_theta);
+    auto reflects = (eta * sin_theta > T(1)) | (u < reflect_probability);
+
+    auto reflected = incident - (T(2) * dot(incident, normal)) * normal;
+    auto perpendicular = eta * (incident + cos_theta * normal);
+    auto k = T(1) - dot(perpendicular, perpendicular);
+    auto parallel_length = sqrt(fmax(k, T(0) - k));
+    auto refracted = perpendicular - parallel_length * normal;
+    return select(reflects, reflected, refracted);
+}
+
+} // namespace material_kernels
+
+#endif
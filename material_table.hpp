@@ -0,0 +1,336 @@
+/**
+ * @file material_table.hpp
+ * @author @rjkilpatrick
+ * @brief A scene's materials packed into arrays by kind, for shading without
+ * virtual calls
+ *
+ * Each material made in the arena gets an entry holding its kind and its
+ * parameters, with a lambertian's albedo read out of its solid colour up
+ * front. A hit reaches its entry through `material::table_entry`, so scatter
+ * is a switch on the kind rather than a call through the material and then
+ * its texture. Hits of one kind can also be scattered together as a batch,
+ * where the maths of material_kernels.hpp runs across SIMD lanes. Anything
+ * the table cannot pack, such as a textured surface, keeps its virtual
+ * `scatter`.
+ *
+ */
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "material.hpp"
+#include "material_kernels.hpp"
+#include "scene_arena.hpp"
+#include "simd.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum class material_kind : uint8_t {
+    lambertian,
+    metal,
+    dielectric,
+    emitter, // Never scatters
+    other    // Left to its virtual `scatter`
+};
+
+/**
+ * @brief Hits of one kind of material, laid out as arrays for `scatter`
+ *
+ * Fill the inputs of the first `size()` hits, and `scatter` fills the
+ * outputs.
+ */
+struct scatter_batch {
+    void resize(size_t n);
+    size_t size() const { return entry.size(); }
+
+    // Inputs
+    std::vector<uint32_t> entry; // Each hit's `material::table_entry`
+    std::vector<double> in_x, in_y, in_z; // Unit direction of the ray in
+    std::vector<double> normal_x, normal_y, normal_z;
+    std::vector<uint8_t> front_face;
+
+    // Outputs
+    std::vector<double> out_x, out_y, out_z; // Direction of the ray out
+    std::vector<double> red, green, blue;    // Attenuation
+    std::vector<uint8_t> scattered;
+
+    // Random numbers and parameters gathered for the kernels
+    std::vector<double> random_x, random_y, random_z, parameter;
+};
+
+class material_table {
+public:
+    material_table() {}
+
+    // Packs every material made in the arena so far
+    material_table(scene_arena& arena);
+
+    size_t size() const { return kinds.size(); }
+
+    material_kind kind_of(const material* mat) const;
+
+    /**
+     * @brief Scatters one hit as its material's virtual `scatter` would
+     */
+    bool scatter(const ray& r_in, const hit_record& rec,
+                 colour3& attenuation, ray& scattered) const;
+
+    /**
+     * @brief Scatters a batch of hits whose materials are all of one kind
+     *
+     * @return false if that kind cannot be scattered from the table
+     */
+    bool scatter(material_kind kind, scatter_batch& batch) const;
+
+public:
+    std::vector<material_kind> kinds;
+    std::vector<double> red, green, blue; // Albedo
+    std::vector<double> parameter;        // Metal's alpha or glass's ior
+    std::vector<const material*> materials;
+
+private:
+    void add(material& mat, material_kind kind, const colour3& albedo,
+             double p);
+};
+
+void scatter_batch::resize(size_t n) {
+    entry.resize(n);
+    for (auto* v : {&in_x, &in_y, &in_z, &normal_x, &normal_y, &normal_z,
+                    &out_x, &out_y, &out_z, &red, &green, &blue, &random_x,
+                    &random_y, &random_z, &parameter}) {
+        v->resize(n);
+    }
+    front_face.resize(n);
+    scattered.resize(n);
+}
+
+material_table::material_table(scene_arena& arena) {
+    arena.for_each<lambertian>([&](lambertian& mat) {
+        // Only a solid colour can be read out ahead of the hit
+        if (dynamic_cast<const solid_colour*>(mat.albedo.get())) {
+            add(mat, material_kind::lambertian,
+                mat.albedo->value(0, 0, point3(0, 0, 0)), 0);
+        } else {
+            add(mat, material_kind::other, colour3(0, 0, 0), 0);
+        }
+    });
+    arena.for_each<metal>([&](metal& mat) {
+        add(mat, material_kind::metal, mat.albedo, mat.alpha);
+    });
+    arena.for_each<dielectric>([&](dielectric& mat) {
+        add(mat, material_kind::dielectric, colour3(1, 1, 1), mat.ior);
+    });
+    arena.for_each<diffuse_light>([&](diffuse_light& mat) {
+        add(mat, material_kind::emitter, colour3(0, 0, 0), 0);
+    });
+}
+
+void material_table::add(material& mat, material_kind kind,
+                         const colour3& albedo, double p) {
+    mat.table_entry = static_cast<uint32_t>(kinds.size());
+    kinds.push_back(kind);
+    red.push_back(albedo.x());
+    green.push_back(albedo.y());
+    blue.push_back(albedo.z());
+    parameter.push_back(p);
+    materials.push_back(&mat);
+}
+
+material_kind material_table::kind_of(const material* mat) const {
+    auto i = mat->table_entry;
+    // The entry may have come from another table
+    if (i >= kinds.size() || materials[i] != mat) {
+        return material_kind::other;
+    }
+    return kinds[i];
+}
+
+bool material_table::scatter(const ray& r_in, const hit_record& rec,
+                             colour3& attenuation, ray& scattered) const {
+    using namespace material_kernels;
+    auto i = rec.mat_ptr->table_entry;
+    lanes<double> direction;
+    switch (kind_of(rec.mat_ptr)) {
+    case material_kind::lambertian:
+        direction = lambertian_direction(lanes_of(rec.normal),
+                                         lanes_of(lambertian_unit_vector()));
+        attenuation = colour3(red[i], green[i], blue[i]);
+        break;
+    case material_kind::metal: {
+        auto disc = random_in_unit_disk();
+        lanes<double> weight{red[i], green[i], blue[i]};
+        if (!metal_scatter(lanes_of(-unit_vector(r_in.direction())),
+                           lanes_of(rec.normal), parameter[i],
+                           double(disc.x()), double(disc.y()), direction,
+                           weight)) {
+            return false;
+        }
+        attenuation = vec3_of(weight);
+        break;
+    }
+    case material_kind::dielectric: {
+        auto eta = rec.front_face ? 1 / parameter[i] : parameter[i];
+        direction = dielectric_direction(
+            lanes_of(unit_vector(r_in.direction())), lanes_of(rec.normal),
+            eta, random_double());
+        attenuation = colour3(1, 1, 1);
+        break;
+    }
+    case material_kind::emitter:
+        return false;
+    default:
+        return rec.mat_ptr->scatter(r_in, rec, attenuation, scattered);
+    }
+
+    auto d = vec3_of(direction);
+    scattered = ray(offset_ray_origin(rec, d), d, r_in.time());
+    return true;
+}
+
+namespace material_table_detail {
+
+using material_kernels::lanes;
+
+// Runs kernel(lanes, j) over [0, n), a SIMD vector of hits at a time and
+// then one at a time, with lanes being vdouble or double
+template <typename kernel_function>
+void for_lanes(size_t n, kernel_function&& kernel) {
+    size_t j = 0;
+    for (; j + simd_width <= n; j += simd_width) {
+        kernel(vdouble(), j);
+    }
+    for (; j < n; ++j) {
+        kernel(0.0, j);
+    }
+}
+
+inline vdouble load(const std::vector<double>& v, size_t j, vdouble) {
+    return vdouble::load(&v[j]);
+}
+inline double load(const std::vector<double>& v, size_t j, double) {
+    return v[j];
+}
+
+inline void store(std::vector<double>& v, size_t j, vdouble x) {
+    x.store(&v[j]);
+}
+inline void store(std::vector<double>& v, size_t j, double x) { v[j] = x; }
+
+template <typename T>
+lanes<T> load(const std::vector<double>& x, const std::vector<double>& y,
+              const std::vector<double>& z, size_t j) {
+    return {load(x, j, T()), load(y, j, T()), load(z, j, T())};
+}
+
+template <typename T>
+void store(std::vector<double>& x, std::vector<double>& y,
+           std::vector<double>& z, size_t j, const lanes<T>& v) {
+    store(x, j, v.x);
+    store(y, j, v.y);
+    store(z, j, v.z);
+}
+
+// Whether each lane of a mask is set, with 1 or 0 through select
+inline void store_mask(std::vector<uint8_t>& v, size_t j, vmask m) {
+    double lanes_set[simd_width];
+    select(m, vdouble(1), vdouble(0)).store(lanes_set);
+    for (int k = 0; k < simd_width; ++k) {
+        v[j + k] = lanes_set[k] != 0;
+    }
+}
+inline void store_mask(std::vector<uint8_t>& v, size_t j, bool m) {
+    v[j] = m;
+}
+
+} // namespace material_table_detail
+
+bool material_table::scatter(material_kind kind, scatter_batch& batch) const {
+    using namespace material_kernels;
+    using namespace material_table_detail;
+    auto n = batch.size();
+    auto& b = batch;
+
+    // Random numbers are drawn one hit at a time, as the generator is
+    // scalar, and parameters are gathered alongside them
+    switch (kind) {
+    case material_kind::lambertian:
+        for (size_t j = 0; j < n; ++j) {
+            auto e = b.entry[j];
+            auto u = lambertian_unit_vector();
+            b.random_x[j] = u.x();
+            b.random_y[j] = u.y();
+            b.random_z[j] = u.z();
+            b.red[j] = red[e];
+            b.green[j] = green[e];
+            b.blue[j] = blue[e];
+        }
+        for_lanes(n, [&](auto zero, size_t j) {
+            using T = decltype(zero);
+            auto normal = load<T>(b.normal_x, b.normal_y, b.normal_z, j);
+            auto random = load<T>(b.random_x, b.random_y, b.random_z, j);
+            store(b.out_x, b.out_y, b.out_z, j,
+                  lambertian_direction(normal, random));
+        });
+        std::fill(b.scattered.begin(), b.scattered.begin() + n, 1);
+        return true;
+
+    case material_kind::metal:
+        for (size_t j = 0; j < n; ++j) {
+            auto e = b.entry[j];
+            auto disc = random_in_unit_disk();
+            b.random_x[j] = disc.x();
+            b.random_y[j] = disc.y();
+            b.parameter[j] = parameter[e];
+            b.red[j] = red[e];
+            b.green[j] = green[e];
+            b.blue[j] = blue[e];
+        }
+        for_lanes(n, [&](auto zero, size_t j) {
+            using T = decltype(zero);
+            auto in = load<T>(b.in_x, b.in_y, b.in_z, j);
+            auto wo = lanes<T>{T(0) - in.x, T(0) - in.y, T(0) - in.z};
+            auto normal = load<T>(b.normal_x, b.normal_y, b.normal_z, j);
+            auto weight = load<T>(b.red, b.green, b.blue, j);
+            lanes<T> direction;
+            auto alive = metal_scatter(
+                wo, normal, load(b.parameter, j, T()),
+                load(b.random_x, j, T()), load(b.random_y, j, T()),
+                direction, weight);
+            store(b.out_x, b.out_y, b.out_z, j, direction);
+            store(b.red, b.green, b.blue, j, weight);
+            store_mask(b.scattered, j, alive);
+        });
+        return true;
+
+    case material_kind::dielectric:
+        for (size_t j = 0; j < n; ++j) {
+            auto ior = parameter[b.entry[j]];
+            b.parameter[j] = b.front_face[j] ? 1 / ior : ior;
+            b.random_x[j] = random_double();
+        }
+        for_lanes(n, [&](auto zero, size_t j) {
+            using T = decltype(zero);
+            auto in = load<T>(b.in_x, b.in_y, b.in_z, j);
+            auto normal = load<T>(b.normal_x, b.normal_y, b.normal_z, j);
+            store(b.out_x, b.out_y, b.out_z, j,
+                  dielectric_direction(in, normal, load(b.parameter, j, T()),
+                                       load(b.random_x, j, T())));
+        });
+        std::fill(b.red.begin(), b.red.begin() + n, 1.0);
+        std::fill(b.green.begin(), b.green.begin() + n, 1.0);
+        std::fill(b.blue.begin(), b.blue.begin() + n, 1.0);
+        std::fill(b.scattered.begin(), b.scattered.begin() + n, 1);
+        return true;
+
+    case material_kind::emitter:
+        std::fill(b.scattered.begin(), b.scattered.begin() + n, 0);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+#endif
@@ -0,0 +1,838 @@
+/**
+ * @file mesh_loader.hpp
+ * @author @rjkilpatrick
+ * @brief Loads binary PLY and OBJ files into a `triangle_mesh`
+ *
+ * Both files are memory-mapped. Binary PLY vertex data is used in place
+ * when its layout allows, and OBJ files are parsed in parallel chunks which
+ * are stitched together afterwards. Load throughput is reported on stderr.
+ *
+ */
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "triangle_mesh.hpp"
+#include "utils.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A read-only view of a whole file, unmapped when destroyed
+class mapped_file {
+public:
+    explicit mapped_file(const char* filename);
+    ~mapped_file() {
+        if (bytes != nullptr) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool is_open() const { return bytes != nullptr; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+mapped_file::mapped_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        void* p = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ,
+                       MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            bytes = static_cast<const char*>(p);
+            length = static_cast<size_t>(status.st_size);
+            madvise(p, length, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+// Keeps a mapped file alive with whatever had to be copied out of it
+struct loaded_mesh_storage {
+    std::shared_ptr<mapped_file> file;
+    mesh_data copied;
+};
+
+namespace mesh_loader_detail {
+
+inline void report_load(const char* filename, size_t bytes,
+                        size_t triangles,
+                        std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> seconds =
+        std::chrono::steady_clock::now() - start;
+    auto megabytes = bytes / (1024.0 * 1024.0);
+    std::cerr << "Loaded `" << filename << "': " << triangles
+              << " triangles, " << megabytes << " MB in " << seconds.count()
+              << " s (" << megabytes / seconds.count() << " MB/s)\n";
+}
+
+// PLY
+
+enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32,
+                      float64, invalid };
+
+inline ply_type parse_ply_type(const std::string& name) {
+    if (name == "char" || name == "int8")
+        return ply_type::int8;
+    if (name == "uchar" || name == "uint8")
+        return ply_type::uint8;
+    if (name == "short" || name == "int16")
+        return ply_type::int16;
+    if (name == "ushort" || name == "uint16")
+        return ply_type::uint16;
+    if (name == "int" || name == "int32")
+        return ply_type::int32;
+    if (name == "uint" || name == "uint32")
+        return ply_type::uint32;
+    if (name == "float" || name == "float32")
+        return ply_type::float32;
+    if (name == "double" || name == "float64")
+        return ply_type::float64;
+    return ply_type::invalid;
+}
+
+inline size_t ply_type_size(ply_type type) {
+    switch (type) {
+    case ply_type::int8:
+    case ply_type::uint8:
+        return 1;
+    case ply_type::int16:
+    case ply_type::uint16:
+        return 2;
+    case ply_type::int32:
+    case ply_type::uint32:
+    case ply_type::float32:
+        return 4;
+    case ply_type::float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Reads one little-endian value, as a double since every type fits in one
+inline double read_ply_value(const char* p, ply_type type) {
+    switch (type) {
+    case ply_type::int8:
+        return static_cast<int8_t>(*p);
+    case ply_type::uint8:
+        return static_cast<uint8_t>(*p);
+    case ply_type::int16: {
+        int16_t x;
+        std::memcpy(&x, p, sizeof x);
+        return x;
+    }
+    case ply_type::uint16: {
+        uint16_t x;
+        std::memcpy(&x, p, sizeof x);
+        return x;
+    }
+    case ply_type::int32: {
+        int32_t x;
+        std::memcpy(&x, p, sizeof x);
+        return x;
+    }
+    case ply_type::uint32: {
+        uint32_t x;
+        std::memcpy(&x, p, sizeof x);
+        return x;
+    }
+    case ply_type::float32: {
+        float x;
+        std::memcpy(&x, p, sizeof x);
+        return x;
+    }
+    case ply_type::float64: {
+        double x;
+        std::memcpy(&x, p, sizeof x);
+        return x;
+    }
+    default:
+        return 0;
+    }
+}
+
+struct ply_property {
+    std::string name;
+    ply_type type;
+    ply_type count_type = ply_type::invalid; // Set for list properties
+    size_t offset = 0;                       // Within fixed size records
+
+    bool is_list() const { return count_type != ply_type::invalid; }
+};
+
+struct ply_element {
+    std::string name;
+    size_t count;
+    std::vector<ply_property> properties;
+    size_t record_size = 0; // 0 when there are list properties
+
+    int find(const char* property_name) const {
+        for (size_t i = 0; i < properties.size(); ++i) {
+            if (properties[i].name == property_name) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+};
+
+// Returns the end of the element's records, or nullptr if they overrun end
+inline const char* skip_ply_element(const ply_element& element,
+                                    const char* p, const char* end) {
+    if (element.record_size > 0) {
+        if (static_cast<size_t>(end - p) / element.record_size <
+            element.count) {
+            return nullptr;
+        }
+        return p + element.count * element.record_size;
+    }
+    for (size_t i = 0; i < element.count; ++i) {
+        for (const auto& property : element.properties) {
+            if (!property.is_list()) {
+                p += ply_type_size(property.type);
+                continue;
+            }
+            if (end - p < static_cast<ptrdiff_t>(
+                              ply_type_size(property.count_type))) {
+                return nullptr;
+            }
+            auto n =
+                static_cast<size_t>(read_ply_value(p, property.count_type));
+            p += ply_type_size(property.count_type) +
+                 n * ply_type_size(property.type);
+        }
+        if (p > end) {
+            return nullptr;
+        }
+    }
+    return p;
+}
+
+// A view of float components if they sit in place in the records as
+// consecutive floats
+inline attribute_view ply_view(const ply_element& vertices,
+                               const char* records,
+                               std::initializer_list<int> components) {
+    int first = *components.begin();
+    size_t expected_offset = vertices.properties[first].offset;
+    for (int c : components) {
+        if (c < 0 || vertices.properties[c].type != ply_type::float32 ||
+            vertices.properties[c].offset != expected_offset) {
+            return {};
+        }
+        expected_offset += sizeof(float);
+    }
+    return {records + vertices.properties[first].offset, vertices.record_size};
+}
+
+// Copies components out of the records when they cannot be used in place
+inline attribute_view copy_ply_components(const ply_element& vertices,
+                                          const char* records,
+                                          std::initializer_list<int> components,
+                                          std::vector<float>& out) {
+    out.resize(vertices.count * components.size());
+    auto q = out.data();
+    for (size_t i = 0; i < vertices.count; ++i) {
+        auto record = records + i * vertices.record_size;
+        for (int c : components) {
+            const auto& property = vertices.properties[c];
+            *q++ = static_cast<float>(
+                read_ply_value(record + property.offset, property.type));
+        }
+    }
+    return {reinterpret_cast<const char*>(out.data()),
+            components.size() * sizeof(float)};
+}
+
+// OBJ
+
+// Parses a decimal number such as -1.25e-3. It is much faster than strtof
+// and accurate enough for geometry. Returns p if there was no number.
+inline const char* parse_float(const char* p, const char* end, float& out) {
+    static const double powers_of_ten[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    auto start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (mantissa < 1000000000000000000ULL) {
+            mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0');
+        } else {
+            ++exponent;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (mantissa < 1000000000000000000ULL) {
+                mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (digits == 0) {
+        out = 0;
+        return start;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        auto q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negative_exponent = *q++ == '-';
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+                e = std::min(10 * e + (*q - '0'), 1000);
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    auto value = static_cast<double>(mantissa);
+    if (exponent < 0) {
+        value = -exponent <= 22 ? value / powers_of_ten[-exponent]
+                                : value * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        value = exponent <= 22 ? value * powers_of_ten[exponent]
+                               : value * std::pow(10.0, exponent);
+    }
+    out = static_cast<float>(negative ? -value : value);
+    return p;
+}
+
+inline const char* parse_int(const char* p, const char* end, int64_t& out) {
+    auto start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    int64_t value = 0;
+    auto digits = p;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        value = 10 * value + (*p - '0');
+    }
+    if (p == digits) {
+        out = 0;
+        return start;
+    }
+    out = negative ? -value : value;
+    return p;
+}
+
+// One corner of a face. Indices are 0-based, -1 if absent. Negative OBJ
+// indices count back from the end of the chunk until the chunk's offsets
+// are known.
+struct obj_corner {
+    int64_t index[3] = {-1, -1, -1}; // Position, texture co-ordinate, normal
+    uint8_t relative = 0;            // Bit per index
+};
+
+struct obj_chunk {
+    std::vector<float> positions, uvs, normals;
+    std::vector<obj_corner> corners; // Three per triangle
+};
+
+inline void parse_obj_chunk(const char* p, const char* end, obj_chunk& chunk) {
+    auto skip_blanks = [&] {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+    };
+    auto read_floats = [&](std::vector<float>& out, int n) {
+        for (int i = 0; i < n; ++i) {
+            skip_blanks();
+            float x;
+            p = parse_float(p, end, x);
+            out.push_back(x);
+        }
+    };
+
+    std::vector<obj_corner> face;
+    while (p < end) {
+        skip_blanks();
+        if (end - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            ++p;
+            read_floats(chunk.positions, 3);
+        } else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' &&
+                   (p[2] == ' ' || p[2] == '\t')) {
+            p += 2;
+            read_floats(chunk.uvs, 2);
+        } else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' &&
+                   (p[2] == ' ' || p[2] == '\t')) {
+            p += 2;
+            read_floats(chunk.normals, 3);
+        } else if (end - p >= 2 && p[0] == 'f' &&
+                   (p[1] == ' ' || p[1] == '\t')) {
+            ++p;
+            size_t counts[3] = {chunk.positions.size() / 3,
+                                chunk.uvs.size() / 2,
+                                chunk.normals.size() / 3};
+            face.clear();
+            while (true) {
+                skip_blanks();
+                obj_corner corner;
+                int64_t value;
+                auto next = parse_int(p, end, value);
+                if (next == p) {
+                    break;
+                }
+                p = next;
+                for (int k = 0; k < 3; ++k) {
+                    if (k > 0) {
+                        if (p == end || *p != '/') {
+                            break;
+                        }
+                        next = parse_int(++p, end, value);
+                        if (next == p) {
+                            continue; // As in v//vn
+                        }
+                        p = next;
+                    }
+                    if (value < 0) {
+                        corner.index[k] =
+                            static_cast<int64_t>(counts[k]) + value;
+                        corner.relative |= 1 << k;
+                    } else {
+                        corner.index[k] = value - 1;
+                    }
+                }
+                face.push_back(corner);
+            }
+
+            // Fan out polygons into triangles
+            for (size_t i = 2; i < face.size(); ++i) {
+                chunk.corners.push_back(face[0]);
+                chunk.corners.push_back(face[i - 1]);
+                chunk.corners.push_back(face[i]);
+            }
+        }
+
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+    }
+}
+
+struct obj_key {
+    int64_t position, uv, normal;
+
+    bool operator==(const obj_key& other) const {
+        return position == other.position && uv == other.uv &&
+               normal == other.normal;
+    }
+};
+
+struct obj_key_hash {
+    size_t operator()(const obj_key& k) const {
+        auto h = static_cast<uint64_t>(k.position) * 0x9e3779b97f4a7c15ULL;
+        h ^= static_cast<uint64_t>(k.uv) + 0x7f4a7c159e3779b9ULL + (h << 6);
+        h ^= static_cast<uint64_t>(k.normal) + 0x94d049bb133111ebULL + (h >> 2);
+        return static_cast<size_t>(h);
+    }
+};
+
+} // namespace mesh_loader_detail
+
+/**
+ * @brief Loads a binary little-endian PLY file
+ *
+ * Faces are fanned out into triangles. Vertex positions, normals (nx, ny,
+ * nz) and texture co-ordinates (u, v or s, t) stored as consecutive floats
+ * are used straight from the mapped file.
+ *
+ * @return std::shared_ptr<triangle_mesh> nullptr if the file could not be
+ * loaded
+ */
+std::shared_ptr<triangle_mesh> load_ply(const char* filename,
+                                        std::shared_ptr<material> m) {
+    using namespace mesh_loader_detail;
+    auto start = std::chrono::steady_clock::now();
+
+    auto storage = std::make_shared<loaded_mesh_storage>();
+    storage->file = std::make_shared<mapped_file>(filename);
+    const auto& file = *storage->file;
+    if (!file.is_open()) {
+        std::cerr << "ERROR: Could not open mesh file `" << filename << "'.\n";
+        return nullptr;
+    }
+    auto fail = [&](const char* reason) {
+        std::cerr << "ERROR: Could not load PLY file `" << filename
+                  << "': " << reason << ".\n";
+        return nullptr;
+    };
+
+    // Header
+    const char* end = file.data() + file.size();
+    const char* marker = "end_header";
+    auto header_end = std::search(file.data(), end, marker,
+                                  marker + std::strlen(marker));
+    if (header_end == end) {
+        return fail("no end_header");
+    }
+    auto body = static_cast<const char*>(
+        std::memchr(header_end, '\n', end - header_end));
+    if (body == nullptr) {
+        return fail("no data");
+    }
+    ++body;
+
+    std::istringstream header(std::string(file.data(), header_end));
+    std::string line, word;
+    std::vector<ply_element> elements;
+    std::getline(header, line);
+    if (line.compare(0, 3, "ply") != 0) {
+        return fail("not a PLY file");
+    }
+    while (std::getline(header, line)) {
+        std::istringstream tokens(line);
+        tokens >> word;
+        if (word == "format") {
+            tokens >> word;
+            if (word != "binary_little_endian") {
+                return fail("only binary_little_endian is supported");
+            }
+        } else if (word == "element") {
+            elements.push_back({});
+            tokens >> elements.back().name >> elements.back().count;
+        } else if (word == "property" && !elements.empty()) {
+            ply_property property;
+            tokens >> word;
+            if (word == "list") {
+                tokens >> word;
+                property.count_type = parse_ply_type(word);
+                tokens >> word;
+            }
+            property.type = parse_ply_type(word);
+            tokens >> property.name;
+            if (property.type == ply_type::invalid ||
+                (property.is_list() &&
+                 property.count_type == ply_type::invalid)) {
+                return fail("unknown property type");
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+
+    for (auto& element : elements) {
+        size_t offset = 0;
+        bool fixed = true;
+        for (auto& property : element.properties) {
+            property.offset = offset;
+            offset += ply_type_size(property.type);
+            fixed = fixed && !property.is_list();
+        }
+        element.record_size = fixed ? offset : 0;
+    }
+
+    // Find the vertex and face records
+    const ply_element* vertices = nullptr;
+    const ply_element* faces = nullptr;
+    const char* vertex_records = nullptr;
+    const char* face_records = nullptr;
+    auto p = body;
+    for (const auto& element : elements) {
+        if (element.name == "vertex") {
+            vertices = &element;
+            vertex_records = p;
+        } else if (element.name == "face") {
+            faces = &element;
+            face_records = p;
+        }
+        p = skip_ply_element(element, p, end);
+        if (p == nullptr) {
+            return fail("file is truncated");
+        }
+    }
+    if (vertices == nullptr || faces == nullptr) {
+        return fail("no vertex or face element");
+    }
+    if (vertices->record_size == 0) {
+        return fail("vertex element has list properties");
+    }
+
+    // Vertex attributes, in place if possible
+    auto& copied = storage->copied;
+    auto x = vertices->find("x"), y = vertices->find("y"),
+         z = vertices->find("z");
+    if (x < 0 || y < 0 || z < 0) {
+        return fail("vertices have no position");
+    }
+    auto positions = ply_view(*vertices, vertex_records, {x, y, z});
+    if (positions.empty()) {
+        positions = copy_ply_components(*vertices, vertex_records, {x, y, z},
+                                        copied.positions);
+    }
+
+    attribute_view normals;
+    auto nx = vertices->find("nx"), ny = vertices->find("ny"),
+         nz = vertices->find("nz");
+    if (nx >= 0 && ny >= 0 && nz >= 0) {
+        normals = ply_view(*vertices, vertex_records, {nx, ny, nz});
+        if (normals.empty()) {
+            normals = copy_ply_components(*vertices, vertex_records,
+                                          {nx, ny, nz}, copied.normals);
+        }
+    }
+
+    attribute_view uvs;
+    auto u = vertices->find("u"), v = vertices->find("v");
+    if (u < 0 || v < 0) {
+        u = vertices->find("s");
+        v = vertices->find("t");
+    }
+    if (u >= 0 && v >= 0) {
+        uvs = ply_view(*vertices, vertex_records, {u, v});
+        if (uvs.empty()) {
+            uvs = copy_ply_components(*vertices, vertex_records, {u, v},
+                                      copied.uvs);
+        }
+    }
+
+    // Faces are interleaved with their vertex counts, so always copied
+    auto index_property = faces->find("vertex_indices");
+    if (index_property < 0) {
+        index_property = faces->find("vertex_index");
+    }
+    if (index_property < 0 || !faces->properties[index_property].is_list()) {
+        return fail("faces have no vertex_indices list");
+    }
+
+    auto& indices = copied.indices;
+    indices.reserve(3 * faces->count);
+    p = face_records;
+    uint32_t face[64];
+    for (size_t i = 0; i < faces->count; ++i) {
+        for (int k = 0; k < static_cast<int>(faces->properties.size()); ++k) {
+            const auto& property = faces->properties[k];
+            if (!property.is_list()) {
+                p += ply_type_size(property.type);
+                continue;
+            }
+            auto n =
+                static_cast<size_t>(read_ply_value(p, property.count_type));
+            p += ply_type_size(property.count_type);
+            auto size = ply_type_size(property.type);
+            if (k != index_property) {
+                p += n * size;
+                continue;
+            }
+            if (n > 64) {
+                return fail("face has more than 64 vertices");
+            }
+            for (size_t j = 0; j < n; ++j, p += size) {
+                auto index = read_ply_value(p, property.type);
+                if (index < 0 || index >= vertices->count) {
+                    return fail("vertex index out of range");
+                }
+                face[j] = static_cast<uint32_t>(index);
+            }
+            for (size_t j = 2; j < n; ++j) {
+                indices.push_back(face[0]);
+                indices.push_back(face[j - 1]);
+                indices.push_back(face[j]);
+            }
+        }
+    }
+
+    report_load(filename, file.size(), indices.size() / 3, start);
+    auto triangles = indices.size() / 3;
+    return std::make_shared<triangle_mesh>(positions, normals, uvs,
+                                           indices.data(), triangles, storage,
+                                           m);
+}
+
+/**
+ * @brief Loads the triangles of an OBJ file, ignoring groups and materials
+ *
+ * The file is split at line boundaries into a chunk per hardware thread and
+ * parsed in parallel.
+ *
+ * @return std::shared_ptr<triangle_mesh> nullptr if the file could not be
+ * loaded
+ */
+std::shared_ptr<triangle_mesh> load_obj(const char* filename,
+                                        std::shared_ptr<material> m) {
+    using namespace mesh_loader_detail;
+    auto start = std::chrono::steady_clock::now();
+
+    mapped_file file(filename);
+    if (!file.is_open()) {
+        std::cerr << "ERROR: Could not open mesh file `" << filename << "'.\n";
+        return nullptr;
+    }
+    const char* begin = file.data();
+    const char* end = begin + file.size();
+
+    // Chunk boundaries, moved on to the start of the next line
+    size_t chunk_count = std::max(1u, std::thread::hardware_concurrency());
+    chunk_count = std::min(chunk_count, file.size() / (1 << 16) + 1);
+    std::vector<const char*> bounds{begin};
+    for (size_t i = 1; i < chunk_count; ++i) {
+        auto p = std::max(begin + i * file.size() / chunk_count, bounds.back());
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        bounds.push_back(newline ? newline + 1 : end);
+    }
+    bounds.push_back(end);
+
+    std::vector<obj_chunk> chunks(chunk_count);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunk_count; ++i) {
+        workers.emplace_back(parse_obj_chunk, bounds[i], bounds[i + 1],
+                             std::ref(chunks[i]));
+    }
+    parse_obj_chunk(bounds[0], bounds[1], chunks[0]);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // Turn chunk relative indices into file indices
+    int64_t offsets[3] = {0, 0, 0};
+    bool has_uvs = true, has_normals = true;
+    size_t corner_count = 0;
+    for (auto& chunk : chunks) {
+        for (auto& corner : chunk.corners) {
+            for (int k = 0; k < 3; ++k) {
+                if (corner.relative & (1 << k)) {
+                    corner.index[k] += offsets[k];
+                }
+            }
+            has_uvs = has_uvs && corner.index[1] >= 0;
+            has_normals = has_normals && corner.index[2] >= 0;
+        }
+        offsets[0] += chunk.positions.size() / 3;
+        offsets[1] += chunk.uvs.size() / 2;
+        offsets[2] += chunk.normals.size() / 3;
+        corner_count += chunk.corners.size();
+    }
+
+    auto in_range = [&](const obj_corner& corner) {
+        return corner.index[0] >= 0 && corner.index[0] < offsets[0] &&
+               (!has_uvs || corner.index[1] < offsets[1]) &&
+               (!has_normals || corner.index[2] < offsets[2]);
+    };
+
+    mesh_data data;
+    data.indices.reserve(corner_count);
+    if (!has_uvs && !has_normals) {
+        // Corners are just positions, so the indices are used as they are
+        data.positions.reserve(3 * offsets[0]);
+        for (auto& chunk : chunks) {
+            data.positions.insert(data.positions.end(),
+                                  chunk.positions.begin(),
+                                  chunk.positions.end());
+            for (const auto& corner : chunk.corners) {
+                if (!in_range(corner)) {
+                    std::cerr << "ERROR: Could not load OBJ file `" << filename
+                              << "': vertex index out of range.\n";
+                    return nullptr;
+                }
+                data.indices.push_back(static_cast<uint32_t>(corner.index[0]));
+            }
+        }
+    } else {
+        // Each distinct combination of attributes becomes a vertex
+        auto gather = [&](std::vector<float> obj_chunk::*attribute) {
+            std::vector<float> all;
+            for (auto& chunk : chunks) {
+                all.insert(all.end(), (chunk.*attribute).begin(),
+                           (chunk.*attribute).end());
+            }
+            return all;
+        };
+        auto positions = gather(&obj_chunk::positions);
+        auto uvs = gather(&obj_chunk::uvs);
+        auto normals = gather(&obj_chunk::normals);
+
+        std::unordered_map<obj_key, uint32_t, obj_key_hash> vertices;
+        for (auto& chunk : chunks) {
+            for (const auto& corner : chunk.corners) {
+                if (!in_range(corner)) {
+                    std::cerr << "ERROR: Could not load OBJ file `" << filename
+                              << "': vertex index out of range.\n";
+                    return nullptr;
+                }
+                obj_key key{corner.index[0], has_uvs ? corner.index[1] : -1,
+                            has_normals ? corner.index[2] : -1};
+                auto next = static_cast<uint32_t>(vertices.size());
+                auto inserted = vertices.emplace(key, next);
+                if (inserted.second) {
+                    auto p = &positions[3 * key.position];
+                    data.positions.insert(data.positions.end(), p, p + 3);
+                    if (has_uvs) {
+                        auto t = &uvs[2 * key.uv];
+                        data.uvs.insert(data.uvs.end(), t, t + 2);
+                    }
+                    if (has_normals) {
+                        auto n = &normals[3 * key.normal];
+                        data.normals.insert(data.normals.end(), n, n + 3);
+                    }
+                }
+                data.indices.push_back(inserted.first->second);
+            }
+        }
+    }
+
+    report_load(filename, file.size(), data.indices.size() / 3, start);
+    return std::make_shared<triangle_mesh>(std::move(data), m);
+}
+
+/**
+ * @brief Loads a PLY or OBJ file by its extension
+ *
+ * @return std::shared_ptr<triangle_mesh> nullptr if the file could not be
+ * loaded
+ */
+std::shared_ptr<triangle_mesh> load_mesh(const std::string& filename,
+                                         std::shared_ptr<material> m) {
+    auto dot = filename.rfind('.');
+    auto extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+
+    if (extension == "ply") {
+        return load_ply(filename.c_str(), m);
+    }
+    if (extension == "obj") {
+        return load_obj(filename.c_str(), m);
+    }
+    std::cerr << "ERROR: Unknown mesh file type `" << filename << "'.\n";
+    return nullptr;
+}
+
+#endif
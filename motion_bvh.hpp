@@ -0,0 +1,329 @@
+/**
+ * @file motion_bvh.hpp
+ * @author @rjkilpatrick
+ * @brief Bounding Volume Hierachy for moving objects
+ *
+ * Each node keeps its bounds at several evenly spaced times across the
+ * shutter interval and rays test the box interpolated to their own time,
+ * rather than the union over the whole interval. Objects are assumed to move
+ * linearly between keys, which `moving_sphere` does exactly.
+ *
+ */
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "hittable_list.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+class motion_bvh : public hittable {
+public:
+    motion_bvh(){};
+
+    motion_bvh(const hittable_list& list, double time_start, double time_end,
+               int keys = 4)
+        : motion_bvh(list.objects, time_start, time_end, keys) {}
+
+    motion_bvh(const std::vector<std::shared_ptr<hittable>>& objects,
+               double time_start, double time_end, int keys = 4);
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    // Hits name the primitive that was hit, which shades them itself
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {}
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override;
+
+public:
+    struct node {
+        uint32_t offset; // First primitive of a leaf or right child index
+        uint16_t count;  // Number of primitives, 0 for interior nodes
+        uint16_t axis;   // Split axis, decides which child is visited first
+    };
+
+    static constexpr int max_leaf_size = 4;
+    static constexpr int bins = 12;
+
+    std::vector<std::shared_ptr<hittable>> primitives;
+    std::vector<node> nodes;
+    std::vector<aabb> key_bounds; // time_keys boxes per node
+    double time0, time1;
+    int time_keys;
+
+private:
+    uint32_t build(size_t start, size_t end);
+    const aabb& primitive_key(size_t primitive, int key) const {
+        return primitive_keys[primitive * time_keys + key];
+    }
+
+    // Builder scratch space
+    std::vector<aabb> primitive_keys;
+    std::vector<point3> centroids;
+    std::vector<uint32_t> order;
+};
+
+motion_bvh::motion_bvh(const std::vector<std::shared_ptr<hittable>>& objects,
+                       double time_start, double time_end, int keys)
+    : time0(time_start), time1(time_end),
+      time_keys(time_end > time_start ? std::max(keys, 2) : 1) {
+    if (objects.empty()) {
+        return;
+    }
+
+    primitive_keys.resize(objects.size() * time_keys);
+    centroids.resize(objects.size());
+    order.resize(objects.size());
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        for (int k = 0; k < time_keys; ++k) {
+            auto time =
+                time_keys == 1
+                    ? time0
+                    : time0 + (time1 - time0) * k / double(time_keys - 1);
+            if (!objects[i]->bounding_box(time, time,
+                                          primitive_keys[i * time_keys + k])) {
+                std::cerr << "No bounding box in motion_bvh constructor.\n";
+            }
+        }
+
+        // Split on where the object is mid-shutter
+        const auto& mid = primitive_key(i, time_keys / 2);
+        centroids[i] = 0.5 * (mid.min() + mid.max());
+        order[i] = static_cast<uint32_t>(i);
+    }
+
+    nodes.reserve(2 * objects.size());
+    key_bounds.reserve(2 * objects.size() * time_keys);
+    build(0, objects.size());
+
+    primitives.reserve(objects.size());
+    for (auto i : order) {
+        primitives.push_back(objects[i]);
+    }
+
+    primitive_keys.clear();
+    primitive_keys.shrink_to_fit();
+    centroids.clear();
+    centroids.shrink_to_fit();
+    order.clear();
+    order.shrink_to_fit();
+}
+
+uint32_t motion_bvh::build(size_t start, size_t end) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({0, 0, 0});
+
+    // The node's bounds at every key
+    for (int k = 0; k < time_keys; ++k) {
+        aabb box = primitive_key(order[start], k);
+        for (auto i = start + 1; i < end; ++i) {
+            box = surrounding_box(box, primitive_key(order[i], k));
+        }
+        key_bounds.push_back(box);
+    }
+
+    auto count = end - start;
+    auto make_leaf = [&]() {
+        nodes[index] = {static_cast<uint32_t>(start),
+                        static_cast<uint16_t>(count), 0};
+        return index;
+    };
+    if (count <= max_leaf_size) {
+        return make_leaf();
+    }
+
+    aabb centroid_box{centroids[order[start]], centroids[order[start]]};
+    for (auto i = start + 1; i < end; ++i) {
+        centroid_box = surrounding_box(
+            centroid_box, aabb{centroids[order[i]], centroids[order[i]]});
+    }
+    auto extent = centroid_box.max() - centroid_box.min();
+    int axis = 0;
+    if (extent.y() > extent[axis])
+        axis = 1;
+    if (extent.z() > extent[axis])
+        axis = 2;
+
+    size_t mid = start + count / 2;
+    if (extent[axis] > 0) {
+        // Binned SAH, with each side's area averaged over the keys
+        auto bin_of = [&](uint32_t primitive) {
+            auto b = static_cast<int>(
+                bins * (centroids[primitive][axis] - centroid_box.min()[axis]) /
+                extent[axis]);
+            return std::min(b, bins - 1);
+        };
+
+        int bin_count[bins] = {};
+        std::vector<aabb> bin_bounds(bins * time_keys);
+        std::vector<bool> bin_used(bins, false);
+        for (auto i = start; i < end; ++i) {
+            auto b = bin_of(order[i]);
+            ++bin_count[b];
+            for (int k = 0; k < time_keys; ++k) {
+                auto& box = bin_bounds[b * time_keys + k];
+                box = bin_used[b]
+                          ? surrounding_box(box, primitive_key(order[i], k))
+                          : primitive_key(order[i], k);
+            }
+            bin_used[b] = true;
+        }
+
+        auto side_cost = [&](int first, int last) {
+            size_t n = 0;
+            std::vector<aabb> side(time_keys);
+            bool any = false;
+            for (int b = first; b < last; ++b) {
+                if (!bin_used[b])
+                    continue;
+                n += bin_count[b];
+                for (int k = 0; k < time_keys; ++k) {
+                    side[k] = any ? surrounding_box(side[k],
+                                                    bin_bounds[b * time_keys + k])
+                                  : bin_bounds[b * time_keys + k];
+                }
+                any = true;
+            }
+            auto area = 0.0;
+            for (const auto& box : side) {
+                area += box.surface_area();
+            }
+            return n * area / time_keys;
+        };
+
+        auto best_cost = infinity;
+        int best_split = -1;
+        for (int split = 1; split < bins; ++split) {
+            auto cost = side_cost(0, split) + side_cost(split, bins);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = split;
+            }
+        }
+
+        auto split_point = std::partition(
+            order.begin() + start, order.begin() + end,
+            [&](uint32_t primitive) { return bin_of(primitive) < best_split; });
+        mid = split_point - order.begin();
+    }
+
+    // Fall back to a median split if the bins could not separate anything
+    if (mid == start || mid == end) {
+        mid = start + count / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid,
+                         order.begin() + end, [&](uint32_t a, uint32_t b) {
+                             return centroids[a][axis] < centroids[b][axis];
+                         });
+    }
+
+    build(start, mid);
+    auto right = build(mid, end);
+    nodes[index] = {right, 0, static_cast<uint16_t>(axis)};
+    return index;
+}
+
+bool motion_bvh::bounding_box(double t0, double t1, aabb& output_box) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    output_box = key_bounds[0];
+    for (int k = 1; k < time_keys; ++k) {
+        output_box = surrounding_box(output_box, key_bounds[k]);
+    }
+    return true;
+}
+
+bool motion_bvh::intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    // Pick the pair of keys either side of the ray's time
+    int key = 0;
+    auto blend = 0.0;
+    if (time_keys > 1) {
+        auto s = clamp((r.time() - time0) / (time1 - time0), 0, 1) *
+                 (time_keys - 1);
+        key = std::min(static_cast<int>(s), time_keys - 2);
+        blend = s - key;
+    }
+
+    vec3 inverse_direction{1 / r.direction().x(), 1 / r.direction().y(),
+                           1 / r.direction().z()};
+    bool direction_negative[3] = {inverse_direction.x() < 0,
+                                  inverse_direction.y() < 0,
+                                  inverse_direction.z() < 0};
+
+    auto node_hit = [&](uint32_t index, double t_far) {
+        const auto* keys = &key_bounds[index * time_keys + key];
+        auto t_near = t_min;
+        for (int i = 0; i < 3; ++i) {
+            auto low = keys[0]._min[i];
+            auto high = keys[0]._max[i];
+            if (time_keys > 1) {
+                low += blend * (keys[1]._min[i] - low);
+                high += blend * (keys[1]._max[i] - high);
+            }
+            auto t0 = (low - r.origin()[i]) * inverse_direction[i];
+            auto t1 = (high - r.origin()[i]) * inverse_direction[i];
+            if (direction_negative[i]) {
+                std::swap(t0, t1);
+            }
+            t_near = fmax(t0, t_near);
+            t_far = fmin(t1, t_far);
+            if (t_far < t_near) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    constexpr int max_stack = 64;
+    uint32_t stack[max_stack];
+    int stack_size = 0;
+    uint32_t index = 0;
+
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    while (true) {
+        const auto& n = nodes[index];
+        if (node_hit(index, closest_so_far)) {
+            if (n.count > 0) {
+                for (uint32_t i = n.offset; i < n.offset + n.count; ++i) {
+                    if (primitives[i]->intersect(r, t_min, closest_so_far,
+                                                 query)) {
+                        hit_anything = true;
+                        closest_so_far = query.t;
+                    }
+                }
+            } else if (direction_negative[n.axis]) {
+                // Visit the nearer child first
+                stack[stack_size++] = index + 1;
+                index = n.offset;
+                continue;
+            } else {
+                stack[stack_size++] = n.offset;
+                index = index + 1;
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        index = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+#endif
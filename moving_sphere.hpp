@@ -4,6 +4,7 @@
 #include "utils.hpp"
 
 #include "hittable.hpp"
+#include "sphere.hpp"
 
 class moving_sphere : public hittable {
 public:
@@ -13,8 +14,11 @@ public:
         : centre_initial(centre_initial), centre_end(centre_end),
           time_initial(t0), time_end(t1), radius(radius), mat_ptr(m){};
 
-    virtual bool hit(const ray& ray, double t_min, double t_max,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
 
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override;
@@ -34,12 +38,18 @@ point3 moving_sphere::centre(double time) const {
                (centre_end - centre_initial);
 }
 
-bool moving_sphere::hit(const ray& r, double t_min, double t_max,
-                        hit_record& rec) const {
-    vec3 oc = r.origin() - centre(r.time());
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
+bool moving_sphere::intersect(const ray& r, double t_min, double t_max,
+                              hit_query& query) const {
+    // In double, as for sphere
+    auto centre_now = centre(r.time());
+    double oc[3], d[3];
+    for (int i = 0; i < 3; ++i) {
+        oc[i] = double(r.origin()[i]) - centre_now[i];
+        d[i] = r.direction()[i];
+    }
+    auto a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    auto half_b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+    auto c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - radius * radius;
     auto discriminant = half_b * half_b - a * c; // $$b^2 - 4ac$$
 
     if (discriminant >
@@ -48,28 +58,27 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max,
 
         auto t = (-half_b - root) / a; // Quadratic formula
         if (t < t_max && t > t_min) {
-            rec.t = t;
-            rec.p = r.at(rec.t);
-            auto outward_normal = (rec.p - centre(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            query.t = t;
+            query.object = this;
             return true;
         }
 
         // Ease of understanding chosen over putting it into a function
         t = (-half_b + root) / a;
         if (t < t_max && t > t_min) {
-            rec.t = t;
-            rec.p = r.at(rec.t);
-            auto outward_normal = (rec.p - centre(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            query.t = t;
+            query.object = this;
             return true;
         }
     }
     return false;
 }
 
+void moving_sphere::shade(const ray& r, const hit_query& query,
+                          hit_record& rec) const {
+    set_sphere_hit(r, query.t, centre(r.time()), radius, mat_ptr.get(), rec);
+}
+
 bool moving_sphere::bounding_box(double t0, double t1, aabb& output_box) const {
     aabb box0{centre(t0) - radius * vec3(1, 1, 1),
               centre(t0) + radius * vec3(1, 1, 1)};
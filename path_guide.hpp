@@ -0,0 +1,411 @@
+/**
+ * @file path_guide.hpp
+ * @author @rjkilpatrick
+ * @brief Learns where light arrives from around the scene, for sampling
+ * bounces towards it
+ *
+ * Follows Müller et al.'s SD-tree. A binary tree over the scene's bounds
+ * splits space wherever many paths pass, and each of its leaves holds a
+ * quadtree over the sphere of directions, refined wherever much light
+ * arrives. A render trains in passes of doubling length. Each pass records
+ * the light its paths find into one set of quadtrees while sampling from
+ * those the pass before filled, and then the trees are rebuilt. Recording
+ * only adds atomically, so threads can share one guide.
+ *
+ */
+#ifndef PATH_GUIDE_H
+#define PATH_GUIDE_H
+
+#include "aabb.hpp"
+#include "material.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace path_guide_detail {
+
+// Cylindrical coordinates, which keep areas on the unit sphere in
+// proportion to areas on the unit square
+inline void square_of(const vec3& direction, double& u, double& v) {
+    auto d = unit_vector(direction);
+    u = clamp(0.5 * (d.z() + 1), 0, 1);
+    auto phi = std::atan2(double(d.y()), double(d.x()));
+    v = phi < 0 ? phi / (2 * M_PI) + 1 : phi / (2 * M_PI);
+}
+
+inline vec3 direction_of(double u, double v) {
+    auto cos_theta = 2 * u - 1;
+    auto sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+    auto phi = 2 * M_PI * v;
+    return vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi),
+                cos_theta);
+}
+
+} // namespace path_guide_detail
+
+/**
+ * @brief Light arriving at a region of space, binned by direction in a
+ * quadtree over the square of cylindrical coordinates
+ */
+class direction_tree {
+public:
+    direction_tree() : nodes(1) {}
+    direction_tree(const direction_tree& other)
+        : nodes(other.nodes), total(other.total),
+          samples(other.samples.load(std::memory_order_relaxed)) {}
+    direction_tree& operator=(const direction_tree& other);
+
+    // Adds light of the given value arriving along -direction
+    void record(const vec3& direction, float value);
+
+    // Sums each node's children, after recording
+    void build();
+
+    // Turns each node's sums into the chances of picking its quadrants,
+    // after which only `sample` and `pdf` apply
+    void normalise();
+
+    vec3 sample() const;
+    // Density per unit solid angle with which `sample` picks direction
+    double pdf(const vec3& direction) const;
+
+    /**
+     * @brief The tree to record the next pass into, splitting quadrants
+     * holding more than `threshold` of the light and merging the rest
+     */
+    direction_tree refined(double threshold, int max_depth) const;
+
+public:
+    struct node {
+        node() {
+            for (auto& s : sum) {
+                s.store(0, std::memory_order_relaxed);
+            }
+        }
+        node(const node& other) { *this = other; }
+        node& operator=(const node& other) {
+            for (int q = 0; q < 4; ++q) {
+                sum[q].store(other.sum[q].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+                child[q] = other.child[q];
+            }
+            return *this;
+        }
+
+        float node_total() const {
+            float t = 0;
+            for (auto& s : sum) {
+                t += s.load(std::memory_order_relaxed);
+            }
+            return t;
+        }
+
+        // Light in each quadrant, numbered by (u >= 1/2) + 2 (v >= 1/2),
+        // or once normalised the chance of each
+        std::atomic<float> sum[4];
+        uint32_t child[4] = {0, 0, 0, 0}; // 0 for a leaf
+    };
+
+    std::vector<node> nodes; // The root first, children after parents
+    double total = 0;        // Of all the light, once built
+    std::atomic<uint32_t> samples{0};
+};
+
+direction_tree& direction_tree::operator=(const direction_tree& other) {
+    nodes = other.nodes;
+    total = other.total;
+    samples.store(other.samples.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+    return *this;
+}
+
+void direction_tree::record(const vec3& direction, float value) {
+    double u, v;
+    path_guide_detail::square_of(direction, u, v);
+    uint32_t index = 0;
+    while (true) {
+        int q = (u >= 0.5) + 2 * (v >= 0.5);
+        u = 2 * u - (u >= 0.5);
+        v = 2 * v - (v >= 0.5);
+        if (nodes[index].child[q] == 0) {
+            atomic_add(nodes[index].sum[q], value);
+            return;
+        }
+        index = nodes[index].child[q];
+    }
+}
+
+void direction_tree::build() {
+    for (auto i = nodes.size(); i-- > 0;) {
+        for (int q = 0; q < 4; ++q) {
+            if (nodes[i].child[q] != 0) {
+                nodes[i].sum[q].store(nodes[nodes[i].child[q]].node_total(),
+                                      std::memory_order_relaxed);
+            }
+        }
+    }
+    total = nodes[0].node_total();
+}
+
+void direction_tree::normalise() {
+    for (auto& n : nodes) {
+        auto t = n.node_total();
+        for (auto& s : n.sum) {
+            // Quadrants nothing was recorded in are picked evenly
+            s.store(t > 0 ? s.load(std::memory_order_relaxed) / t : 0.25f,
+                    std::memory_order_relaxed);
+        }
+    }
+}
+
+vec3 direction_tree::sample() const {
+    double x = 0, y = 0, size = 1;
+    uint32_t index = 0;
+    // One number picks the quadrant at every level, rescaled to [0, 1)
+    // within the quadrant it picked
+    auto u = random_double();
+    while (true) {
+        const auto& n = nodes[index];
+        int q = 0;
+        double p = n.sum[0].load(std::memory_order_relaxed);
+        while (q < 3 && u >= p) {
+            u -= p;
+            p = n.sum[++q].load(std::memory_order_relaxed);
+        }
+        u = p > 0 ? clamp(u / p, 0, 1 - 1e-16) : 0;
+        size /= 2;
+        x += (q & 1) * size;
+        y += (q >> 1) * size;
+        if (n.child[q] == 0) {
+            break;
+        }
+        index = n.child[q];
+    }
+    return path_guide_detail::direction_of(x + random_double() * size,
+                                           y + random_double() * size);
+}
+
+double direction_tree::pdf(const vec3& direction) const {
+    double u, v;
+    path_guide_detail::square_of(direction, u, v);
+    // Over the unit square, which covers 4 pi steradians
+    double density = 1 / (4 * M_PI);
+    uint32_t index = 0;
+    while (true) {
+        const auto& n = nodes[index];
+        int q = (u >= 0.5) + 2 * (v >= 0.5);
+        u = 2 * u - (u >= 0.5);
+        v = 2 * v - (v >= 0.5);
+        density *= 4 * n.sum[q].load(std::memory_order_relaxed);
+        if (n.child[q] == 0) {
+            return density;
+        }
+        index = n.child[q];
+    }
+}
+
+direction_tree direction_tree::refined(double threshold, int max_depth) const {
+    direction_tree result;
+    if (!(total > 0)) {
+        result.nodes.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            for (int q = 0; q < 4; ++q) {
+                result.nodes[i].child[q] = nodes[i].child[q];
+            }
+        }
+        return result;
+    }
+
+    struct entry {
+        uint32_t index;     // In the new tree
+        uint32_t old_index; // In this tree, or none if past its leaves
+        double light;
+        int depth;
+    };
+    const uint32_t none = ~0u;
+    std::vector<entry> stack{{0, 0, total, 1}};
+    while (!stack.empty()) {
+        auto e = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; ++q) {
+            // Below this tree's leaves the light is taken as even
+            double light = e.light / 4;
+            auto old_child = none;
+            if (e.old_index != none) {
+                const auto& old = nodes[e.old_index];
+                light = old.sum[q].load(std::memory_order_relaxed);
+                if (old.child[q] != 0) {
+                    old_child = old.child[q];
+                }
+            }
+            if (e.depth >= max_depth || light / total <= threshold) {
+                continue;
+            }
+            auto child = static_cast<uint32_t>(result.nodes.size());
+            result.nodes[e.index].child[q] = child;
+            result.nodes.emplace_back();
+            stack.push_back({child, old_child, light, e.depth + 1});
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief A binary tree over the scene's bounds with a `direction_tree` at
+ * each leaf
+ */
+class path_guide {
+public:
+    path_guide() {}
+    path_guide(const aabb& bounds);
+
+    bool enabled() const { return !nodes.empty(); }
+
+    // Whether to sample bounces off a material from the guide
+    bool guides(const material* mat) const {
+        return trained && mat->samples_lights();
+    }
+    // Whether to record the light arriving at bounces off a material
+    bool records(const material* mat) const {
+        return learning && mat->samples_lights();
+    }
+
+    // Leaf holding p, to look up once for the calls below
+    uint32_t region(const point3& p) const;
+
+    vec3 sample(uint32_t region) const {
+        return leaves[region].sampling.sample();
+    }
+    // Density per unit solid angle with which `sample` picks direction
+    double pdf(uint32_t region, const vec3& direction) const {
+        return leaves[region].sampling.pdf(direction);
+    }
+
+    /**
+     * @brief Records light arriving in region along -direction
+     *
+     * @param pdf Density with which the direction was sampled
+     */
+    void record(uint32_t region, const vec3& direction,
+                const colour3& radiance, double pdf);
+
+    /**
+     * @brief Learns from the pass just recorded, and readies the trees for
+     * the next
+     *
+     * @param pass Counts the passes from 0, each twice as long as the last
+     */
+    void refine(int pass);
+
+public:
+    // Chance of taking a bounce from the guide rather than the material
+    double share = 0.5;
+    bool learning = false;
+    bool trained = false;
+
+    struct node {
+        double split = 0;   // Position of the plane splitting the node
+        uint32_t child = 0; // First of two, below and above the plane, or 0
+                            // for a leaf
+        uint32_t leaf = 0;  // Into leaves, at a leaf
+        int axis = 0;       // Across which the node is split
+    };
+    struct leaf_trees {
+        direction_tree sampling, recording;
+    };
+    std::vector<node> nodes;
+    std::vector<leaf_trees> leaves;
+    aabb bounds;
+
+private:
+    // Paths through a leaf before it splits, scaled by the root of each
+    // pass's length
+    static constexpr double split_samples = 2000;
+    // Share of a leaf's light above which a quadrant splits
+    static constexpr double split_light = 0.03;
+    static constexpr int max_depth = 20;
+};
+
+path_guide::path_guide(const aabb& bounds)
+    : nodes(1), leaves(1), bounds(bounds) {
+    leaves[0].sampling.normalise();
+}
+
+uint32_t path_guide::region(const point3& p) const {
+    uint32_t index = 0;
+    while (nodes[index].child != 0) {
+        const auto& n = nodes[index];
+        index = n.child + (p[n.axis] >= n.split);
+    }
+    return nodes[index].leaf;
+}
+
+void path_guide::record(uint32_t region, const vec3& direction,
+                        const colour3& radiance, double pdf) {
+    auto& recording = leaves[region].recording;
+    recording.samples.fetch_add(1, std::memory_order_relaxed);
+    auto value = (radiance.x() + radiance.y() + radiance.z()) / (3 * pdf);
+    if (value > 0 && std::isfinite(value)) {
+        recording.record(direction, static_cast<float>(value));
+    }
+}
+
+void path_guide::refine(int pass) {
+    // A leaf's children each see about half its paths
+    auto threshold = split_samples * std::sqrt(std::pow(2.0, pass));
+    struct entry {
+        uint32_t index;
+        point3 lower, upper;
+    };
+    std::vector<entry> stack{{0, bounds.min(), bounds.max()}};
+    while (!stack.empty()) {
+        auto e = stack.back();
+        stack.pop_back();
+        if (nodes[e.index].child == 0) {
+            auto& samples = leaves[nodes[e.index].leaf].recording.samples;
+            auto count = samples.load(std::memory_order_relaxed);
+            if (count <= threshold) {
+                continue;
+            }
+            samples.store(count / 2, std::memory_order_relaxed);
+
+            // Across the longest side, and one child keeps the leaf's trees
+            // while the other copies them
+            auto extent = e.upper - e.lower;
+            auto axis = extent.x() > extent.y() ? 0 : 1;
+            axis = extent.z() > extent[axis] ? 2 : axis;
+            auto& n = nodes[e.index];
+            n.axis = axis;
+            n.split = 0.5 * (e.lower[axis] + e.upper[axis]);
+            n.child = static_cast<uint32_t>(nodes.size());
+            node child;
+            child.leaf = n.leaf;
+            nodes.push_back(child);
+            auto copy = leaves[child.leaf];
+            child.leaf = static_cast<uint32_t>(leaves.size());
+            leaves.push_back(copy);
+            nodes.push_back(child);
+        }
+
+        const auto& n = nodes[e.index];
+        auto below = e.upper;
+        auto above = e.lower;
+        below[n.axis] = above[n.axis] = n.split;
+        stack.push_back({n.child, e.lower, below});
+        stack.push_back({n.child + 1, above, e.upper});
+    }
+
+    for (auto& l : leaves) {
+        l.recording.build();
+        l.sampling = l.recording;
+        l.recording = l.sampling.refined(split_light, max_depth);
+        l.sampling.normalise();
+    }
+    trained = true;
+}
+
+#endif
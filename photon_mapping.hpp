@@ -0,0 +1,512 @@
+/**
+ * @file photon_mapping.hpp
+ * @author @rjkilpatrick
+ * @brief Stochastic progressive photon mapping, for caustics that paths
+ * from the camera find only by chance
+ *
+ * Follows Hachisuka and Jensen's SPPM, as laid out in Pharr, Jakob and
+ * Humphreys, "Physically Based Rendering" 3rd ed., 16.2. Each pass follows
+ * one camera path per pixel through mirrors and glass to a visible point on
+ * a diffuse or rough surface, which counts the light it sees and samples the
+ * lights directly. The visible points are hashed into a grid, and photons
+ * from the lights that land near a visible point after at least one bounce
+ * add to its estimate of the light arriving there. Each pixel's gather
+ * radius shrinks as its photons build up, so the estimate converges.
+ *
+ * Passes run on every core. The grid is rebuilt each pass with each visible
+ * point pushed onto its cells' lists by an atomic exchange, and photons add
+ * to the visible points atomically, so no pass takes a lock. Only lights in
+ * the light list send photons, so other emitters and the environment light
+ * only what the camera sees of them directly.
+ *
+ * Photons are followed a wave at a time, bounce by bounce, so that each
+ * bounce's hits on one kind of packed material scatter together as a
+ * `scatter_batch`, across SIMD lanes.
+ *
+ */
+#ifndef PHOTON_MAPPING_H
+#define PHOTON_MAPPING_H
+
+#include "aabb.hpp"
+#include "camera.hpp"
+#include "environment.hpp"
+#include "hittable.hpp"
+#include "lights.hpp"
+#include "material.hpp"
+#include "material_table.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace photon_mapping_detail {
+
+// Where a pixel's camera path first reached a surface it can gather on, and
+// all that pixel has gathered so far
+struct pixel_state {
+    pixel_state() {
+        for (auto& p : phi) {
+            p.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // This pass's visible point
+    bool found = false;
+    hit_record rec;
+    ray incoming;
+    colour3 beta; // Of the camera path up to the point
+
+    // Summed over passes: light the camera saw and light sampled directly
+    colour3 direct{0, 0, 0};
+
+    // The progressive estimate
+    double radius;
+    double photons = 0; // Counted, after shrinking
+    colour3 tau{0, 0, 0};
+
+    // This pass's photons
+    std::atomic<double> phi[3];
+    std::atomic<uint32_t> count{0};
+};
+
+// A photon in flight, and where it last landed
+struct photon {
+    ray r;
+    colour3 beta; // Power it carries
+    hit_record rec;
+    bool alive;
+};
+
+} // namespace photon_mapping_detail
+
+class photon_mapper {
+public:
+    /**
+     * @param initial_radius Gather radius every pixel starts with, in scene
+     * units
+     * @param photons_per_pass Or one per pixel if 0
+     */
+    photon_mapper(const hittable& world, const light_list& lights,
+                  const material_table& materials, const camera& cam,
+                  const environment& background, int width, int height,
+                  int max_bounces, double initial_radius,
+                  size_t photons_per_pass = 0, double time0 = 0,
+                  double time1 = 0);
+
+    /**
+     * @brief Runs the given number of passes, and sets image to their
+     * estimate times the passes, as `write_colour` expects summed samples
+     */
+    void render(std::vector<colour3>& image, int passes);
+
+private:
+    using pixel_state = photon_mapping_detail::pixel_state;
+
+    // Follows each pixel's camera path to its visible point
+    void trace_camera(size_t begin, size_t end);
+
+    // Hashes the visible points into the grid of cells
+    void build_grid();
+
+    void trace_photons(size_t begin, size_t end);
+
+    // Adds a photon landing at p.rec to the visible points around it
+    void gather(const photon_mapping_detail::photon& p);
+
+    /**
+     * @brief Scatters every photon of a wave off where it landed, killing
+     * those absorbed or lost to Russian roulette
+     *
+     * @param batch, members Scratch space, kept between calls
+     */
+    void scatter(std::vector<photon_mapping_detail::photon>& wave,
+                 scatter_batch& batch, std::vector<uint32_t>& members) const;
+
+    // Shrinks each pixel's radius by the photons it gathered this pass
+    void update(size_t begin, size_t end);
+
+    size_t cell_of(int x, int y, int z) const;
+
+    const hittable& world;
+    const light_list& lights;
+    const material_table& materials;
+    const camera& cam;
+    const environment& background;
+    int width, height;
+    int max_bounces;
+    size_t photons_per_pass;
+    double time0, time1;
+
+    std::vector<pixel_state> pixels;
+
+    // Each cell's list of visible points, as a head into entries, and each
+    // entry's pixel and the entry after it
+    static constexpr uint32_t none = ~0u;
+    std::vector<std::atomic<uint32_t>> heads;
+    std::vector<uint32_t> entry_pixel, entry_next;
+    aabb grid_bounds;
+    double cell_size;
+    int resolution[3];
+};
+
+photon_mapper::photon_mapper(const hittable& world, const light_list& lights,
+                             const material_table& materials,
+                             const camera& cam, const environment& background,
+                             int width, int height, int max_bounces,
+                             double initial_radius, size_t photons_per_pass,
+                             double time0, double time1)
+    : world(world), lights(lights), materials(materials), cam(cam),
+      background(background), width(width), height(height),
+      max_bounces(max_bounces),
+      photons_per_pass(photons_per_pass > 0 ? photons_per_pass
+                                            : size_t(width) * height),
+      time0(time0), time1(time1), pixels(size_t(width) * height),
+      heads(size_t(width) * height) {
+    for (auto& p : pixels) {
+        p.radius = initial_radius;
+    }
+}
+
+void photon_mapper::render(std::vector<colour3>& image, int passes) {
+    for (int pass = 0; pass < passes; ++pass) {
+        std::cerr << "\rPhoton passes remaining: " << passes - pass << ' '
+                  << std::flush;
+        parallel_chunks(pixels.size(), 1024, [&](size_t begin, size_t end) {
+            trace_camera(begin, end);
+        });
+        build_grid();
+        parallel_chunks(photons_per_pass, 1024, [&](size_t begin, size_t end) {
+            trace_photons(begin, end);
+        });
+        parallel_chunks(pixels.size(), 1024, [&](size_t begin, size_t end) {
+            update(begin, end);
+        });
+    }
+
+    double photons = double(passes) * photons_per_pass;
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        const auto& p = pixels[i];
+        auto gathered = p.tau / (photons * M_PI * p.radius * p.radius);
+        image[i] = p.direct + passes * gathered;
+    }
+}
+
+void photon_mapper::trace_camera(size_t begin, size_t end) {
+    for (auto index = begin; index < end; ++index) {
+        auto& pixel = pixels[index];
+        int i = static_cast<int>(index % width);
+        int j = static_cast<int>(index / width);
+        auto r = cam.get_ray(double(i + random_double()) / (width - 1),
+                             double(j + random_double()) / (height - 1));
+
+        pixel.found = false;
+        colour3 beta{1, 1, 1};
+        for (int bounce = 0; bounce < max_bounces; ++bounce) {
+            hit_record rec;
+            if (!world.hit(r, 0, infinity, rec)) {
+                pixel.direct += beta * background.value(r.direction());
+                break;
+            }
+            pixel.direct += beta * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+            // Light from the lights straight to a visible point is sampled,
+            // so photons are only gathered once they have bounced
+            if (rec.mat_ptr->samples_lights()) {
+                if (!lights.empty()) {
+                    pixel.direct +=
+                        beta * lights.direct_light(
+                                   r, rec, world,
+                                   [](const vec3&) { return 0.0; });
+                }
+                pixel.found = true;
+                pixel.rec = rec;
+                pixel.incoming = r;
+                pixel.beta = beta;
+                break;
+            }
+
+            colour3 attenuation;
+            ray scattered;
+            if (!materials.scatter(r, rec, attenuation, scattered)) {
+                break;
+            }
+            beta = beta * attenuation;
+            r = scattered;
+        }
+    }
+}
+
+size_t photon_mapper::cell_of(int x, int y, int z) const {
+    auto h = (uint64_t(x) * 73856093u) ^ (uint64_t(y) * 19349663u) ^
+             (uint64_t(z) * 83492791u);
+    return h % heads.size();
+}
+
+void photon_mapper::build_grid() {
+
+    // Cells about the size of the largest radius, over the visible points
+    bool any = false;
+    double max_radius = 0;
+    point3 lower, upper;
+    for (const auto& p : pixels) {
+        if (!p.found) {
+            continue;
+        }
+        vec3 r(p.radius, p.radius, p.radius);
+        lower = any ? fmin(lower, p.rec.p - r) : p.rec.p - r;
+        upper = any ? fmax(upper, p.rec.p + r) : p.rec.p + r;
+        max_radius = std::fmax(max_radius, p.radius);
+        any = true;
+    }
+    for (auto& head : heads) {
+        head.store(none, std::memory_order_relaxed);
+    }
+    if (!any) {
+        entry_pixel.clear();
+        return;
+    }
+    grid_bounds = aabb(lower, upper);
+    cell_size = max_radius;
+    for (int k = 0; k < 3; ++k) {
+        resolution[k] =
+            std::max(1, static_cast<int>(std::ceil((upper[k] - lower[k]) /
+                                                   cell_size)));
+    }
+
+    auto cells_of = [&](const pixel_state& p, int lo[3], int hi[3]) {
+        for (int k = 0; k < 3; ++k) {
+            auto to_cell = [&](double x) {
+                return std::clamp(static_cast<int>(std::floor(
+                                      (x - lower[k]) / cell_size)),
+                                  0, resolution[k] - 1);
+            };
+            lo[k] = to_cell(p.rec.p[k] - p.radius);
+            hi[k] = to_cell(p.rec.p[k] + p.radius);
+        }
+    };
+
+    // Each pixel gets entries for the cells it overlaps, after those of the
+    // pixels before it
+    std::vector<uint32_t> first(pixels.size() + 1, 0);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        uint32_t n = 0;
+        if (pixels[i].found) {
+            int lo[3], hi[3];
+            cells_of(pixels[i], lo, hi);
+            n = (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) *
+                (hi[2] - lo[2] + 1);
+        }
+        first[i + 1] = first[i] + n;
+    }
+    entry_pixel.resize(first.back());
+    entry_next.resize(first.back());
+
+    parallel_chunks(pixels.size(), 1024, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+            if (!pixels[i].found) {
+                continue;
+            }
+            int lo[3], hi[3];
+            cells_of(pixels[i], lo, hi);
+            auto e = first[i];
+            for (int z = lo[2]; z <= hi[2]; ++z) {
+                for (int y = lo[1]; y <= hi[1]; ++y) {
+                    for (int x = lo[0]; x <= hi[0]; ++x) {
+                        entry_pixel[e] = static_cast<uint32_t>(i);
+                        entry_next[e] = heads[cell_of(x, y, z)].exchange(
+                            e, std::memory_order_relaxed);
+                        ++e;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void photon_mapper::trace_photons(size_t begin, size_t end) {
+    if (entry_pixel.empty()) {
+        return;
+    }
+
+    const size_t wave_size = 1024;
+    std::vector<photon_mapping_detail::photon> wave;
+    scatter_batch batch;
+    std::vector<uint32_t> members;
+    for (auto first = begin; first < end; first += wave_size) {
+        wave.clear();
+        for (auto i = first; i < std::min(end, first + wave_size); ++i) {
+            emission_sample e;
+            // Still counts, as a photon carrying no light
+            if (!lights.sample_emission(e)) {
+                continue;
+            }
+            photon_mapping_detail::photon p;
+            p.beta = e.emitted * (std::fabs(dot(e.normal, e.direction)) /
+                                  (e.pdf_position * e.pdf_direction));
+            // Nudged off the light, which has no bound on its rounding error
+            p.r = ray(e.p + EPSILON * e.direction, e.direction,
+                      random_double(time0, time1));
+            wave.push_back(p);
+        }
+
+        for (int bounce = 0; bounce < max_bounces && !wave.empty();
+             ++bounce) {
+            size_t landed = 0;
+            for (auto& p : wave) {
+                if (!world.hit(p.r, 0, infinity, p.rec)) {
+                    continue;
+                }
+                if (bounce > 0) {
+                    gather(p);
+                }
+                wave[landed++] = p;
+            }
+            wave.resize(landed);
+
+            scatter(wave, batch, members);
+            wave.erase(std::remove_if(wave.begin(), wave.end(),
+                                      [](const auto& p) { return !p.alive; }),
+                       wave.end());
+        }
+    }
+}
+
+void photon_mapper::gather(const photon_mapping_detail::photon& photon) {
+    const auto& p = photon.rec.p;
+    const auto& lower = grid_bounds.min();
+    const auto& upper = grid_bounds.max();
+    if (!photon.rec.mat_ptr->samples_lights() || p.x() < lower.x() ||
+        p.y() < lower.y() || p.z() < lower.z() || p.x() > upper.x() ||
+        p.y() > upper.y() || p.z() > upper.z()) {
+        return;
+    }
+
+    int cell[3];
+    for (int k = 0; k < 3; ++k) {
+        cell[k] =
+            std::min(static_cast<int>((p[k] - lower[k]) / cell_size),
+                     resolution[k] - 1);
+    }
+    auto wi = -unit_vector(photon.r.direction());
+    auto entry = heads[cell_of(cell[0], cell[1], cell[2])].load(
+        std::memory_order_relaxed);
+    for (; entry != none; entry = entry_next[entry]) {
+        auto& pixel = pixels[entry_pixel[entry]];
+        const auto& v = pixel.rec;
+        auto cosine = dot(wi, v.normal);
+        if ((v.p - p).length_squared() > pixel.radius * pixel.radius ||
+            cosine <= 0) {
+            continue;
+        }
+        // The visible point's BSDF, without its cosine
+        auto f = v.mat_ptr->eval(pixel.incoming, v, wi) / cosine;
+        auto add = photon.beta * f;
+        for (int k = 0; k < 3; ++k) {
+            atomic_add(pixel.phi[k], double(add[k]));
+        }
+        pixel.count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void photon_mapper::scatter(std::vector<photon_mapping_detail::photon>& wave,
+                            scatter_batch& batch,
+                            std::vector<uint32_t>& members) const {
+    // Russian roulette, by how much of the photon's power survives
+    auto bounce = [&](photon_mapping_detail::photon& p,
+                      const colour3& attenuation, const ray& scattered) {
+        auto survive = std::fmin(
+            1.0, std::fmax(attenuation.x(),
+                           std::fmax(attenuation.y(), attenuation.z())));
+        p.alive = random_double() < survive;
+        p.beta = p.beta * attenuation / survive;
+        p.r = scattered;
+    };
+
+    // Kinds the table cannot batch scatter one at a time
+    for (auto& p : wave) {
+        p.alive = false;
+        switch (materials.kind_of(p.rec.mat_ptr)) {
+        case material_kind::lambertian:
+        case material_kind::metal:
+        case material_kind::dielectric:
+            break;
+        default: {
+            colour3 attenuation;
+            ray scattered;
+            if (materials.scatter(p.r, p.rec, attenuation, scattered)) {
+                bounce(p, attenuation, scattered);
+            }
+        }
+        }
+    }
+
+    for (auto kind : {material_kind::lambertian, material_kind::metal,
+                      material_kind::dielectric}) {
+        members.clear();
+        for (size_t i = 0; i < wave.size(); ++i) {
+            if (materials.kind_of(wave[i].rec.mat_ptr) == kind) {
+                members.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        if (members.empty()) {
+            continue;
+        }
+
+        batch.resize(members.size());
+        for (size_t j = 0; j < members.size(); ++j) {
+            const auto& p = wave[members[j]];
+            auto in = unit_vector(p.r.direction());
+            batch.entry[j] = p.rec.mat_ptr->table_entry;
+            batch.in_x[j] = in.x();
+            batch.in_y[j] = in.y();
+            batch.in_z[j] = in.z();
+            batch.normal_x[j] = p.rec.normal.x();
+            batch.normal_y[j] = p.rec.normal.y();
+            batch.normal_z[j] = p.rec.normal.z();
+            batch.front_face[j] = p.rec.front_face;
+        }
+        materials.scatter(kind, batch);
+
+        for (size_t j = 0; j < members.size(); ++j) {
+            auto& p = wave[members[j]];
+            if (!batch.scattered[j]) {
+                continue;
+            }
+            vec3 direction(batch.out_x[j], batch.out_y[j], batch.out_z[j]);
+            bounce(p,
+                   colour3(batch.red[j], batch.green[j], batch.blue[j]),
+                   ray(offset_ray_origin(p.rec, direction), direction,
+                       p.r.time()));
+        }
+    }
+}
+
+void photon_mapper::update(size_t begin, size_t end) {
+    // Share of each pass's photons kept, which shrinks the radius
+    const double gamma = 2.0 / 3.0;
+    for (auto i = begin; i < end; ++i) {
+        auto& p = pixels[i];
+        auto m = p.count.load(std::memory_order_relaxed);
+        if (m > 0) {
+            colour3 phi(p.phi[0].load(std::memory_order_relaxed),
+                        p.phi[1].load(std::memory_order_relaxed),
+                        p.phi[2].load(std::memory_order_relaxed));
+            auto photons = p.photons + gamma * m;
+            auto radius = p.radius * std::sqrt(photons / (p.photons + m));
+            p.tau = (p.tau + p.beta * phi) *
+                    (radius * radius / (p.radius * p.radius));
+            p.photons = photons;
+            p.radius = radius;
+        }
+        for (auto& phi : p.phi) {
+            phi.store(0, std::memory_order_relaxed);
+        }
+        p.count.store(0, std::memory_order_relaxed);
+    }
+}
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file plane.hpp
+ * @author @rjkilpatrick
+ * @brief Infinite plane, such as a ground
+ *
+ * A plane has no bounding box, so acceleration structures leave it out and
+ * it is tested on its own before them; see `take_unbounded`.
+ *
+ */
+#ifndef PLANE_H
+#define PLANE_H
+
+#include "hittable.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <memory>
+
+class plane : public hittable {
+public:
+    plane() {}
+    plane(const point3& p, const vec3& n, std::shared_ptr<material> m);
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override {
+        return false;
+    }
+
+public:
+    point3 origin; // Where u = v = 0
+    vec3 normal;
+    double offset; // dot(normal, p) for every point p on the plane
+    vec3 tangent, bitangent;
+    std::shared_ptr<material> mat_ptr;
+};
+
+plane::plane(const point3& p, const vec3& n, std::shared_ptr<material> m)
+    : origin(p), normal(unit_vector(n)), mat_ptr(m) {
+    offset = dot(normal, origin);
+    auto helper = std::fabs(normal.x()) > 0.9 ? vec3{0, 1, 0} : vec3{1, 0, 0};
+    tangent = unit_vector(cross(helper, normal));
+    bitangent = cross(normal, tangent);
+}
+
+bool plane::intersect(const ray& r, double t_min, double t_max,
+                      hit_query& query) const {
+    auto t = (offset - dot(normal, r.origin())) / dot(normal, r.direction());
+    // Also rejects rays parallel to the plane
+    if (!(t > t_min && t < t_max)) {
+        return false;
+    }
+
+    query.t = t;
+    query.object = this;
+    return true;
+}
+
+void plane::shade(const ray& r, const hit_query& query,
+                  hit_record& rec) const {
+    rec.t = query.t;
+
+    // Project the hit back onto the plane, so its error depends on where it
+    // is rather than how far the ray travelled
+    auto p = r.at(rec.t);
+    rec.p = p - (dot(normal, p) - offset) * normal;
+    rec.set_error(
+        error_gamma(5) * (abs(rec.p) + std::fabs(offset) * abs(normal)),
+        normal);
+
+    auto local = rec.p - origin;
+    rec.u = dot(local, tangent);
+    rec.v = dot(local, bitangent);
+    rec.set_face_normal(r, normal);
+    rec.mat_ptr = mat_ptr.get();
+}
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file primitive_bvh.hpp
+ * @author @rjkilpatrick
+ * @brief Flat Bounding Volume Hierachy over a primitive_set
+ *
+ * Nodes live in one array in depth-first order, and leaves hold a range of
+ * `primitive_ref`s which are intersected without any virtual calls. The
+ * spheres of each leaf come first, then its rectangles, and each sit next to
+ * each other in their batch so they are tested together.
+ *
+ */
+#ifndef PRIMITIVE_BVH_H
+#define PRIMITIVE_BVH_H
+
+#include "flat_bvh.hpp"
+#include "primitive_set.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+class primitive_bvh : public hittable {
+public:
+    primitive_bvh(){};
+
+    primitive_bvh(const hittable_list& list, double time0, double time1)
+        : primitive_bvh(primitive_set(list), time0, time1) {}
+
+    primitive_bvh(primitive_set set, double time0, double time1);
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    // Hits name the primitive that was hit, which shades them itself
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {}
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override {
+        output_box = nodes.empty() ? aabb() : nodes[0].box;
+        return !nodes.empty();
+    }
+
+public:
+    // Room for a whole vector of spheres or rectangles
+    static constexpr int max_leaf_size = simd_width > 4 ? simd_width : 4;
+    static_assert(max_leaf_size < 16, "Leaf counts must fit in a nibble");
+
+    // Its refs are reordered so each leaf's primitives are contiguous
+    primitive_set primitives;
+    // A leaf's spare byte counts the spheres at its start in the low four
+    // bits and the rectangles after them in the high four
+    std::vector<flat_bvh_node> nodes;
+
+private:
+    void gather_leaf_batches();
+};
+
+primitive_bvh::primitive_bvh(primitive_set set, double time0, double time1)
+    : primitives(std::move(set)) {
+    std::vector<aabb> boxes(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        if (!primitives.bounding_box(primitives.refs[i], time0, time1,
+                                     boxes[i])) {
+            std::cerr << "No bounding box in primitive_bvh constructor.\n";
+        }
+    }
+
+    auto order = build_flat_bvh(std::move(boxes), max_leaf_size, nodes);
+    std::vector<primitive_ref> refs(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        refs[i] = primitives.refs[order[i]];
+    }
+    primitives.refs.swap(refs);
+
+    gather_leaf_batches();
+}
+
+// Renumbers the spheres and rectangles so each leaf's are contiguous, and
+// first in the leaf
+void primitive_bvh::gather_leaf_batches() {
+    sphere_batch ordered;
+    rect_batch ordered_rects;
+    auto is_sphere = [](primitive_ref p) {
+        return p.type() == primitive_type::sphere;
+    };
+    auto is_rect = [](primitive_ref p) {
+        return p.type() == primitive_type::rect;
+    };
+
+    for (auto& n : nodes) {
+        if (n.count == 0) {
+            continue;
+        }
+        auto begin = primitives.refs.begin() + n.offset;
+        auto end = begin + n.count;
+        auto spheres_end = std::stable_partition(begin, end, is_sphere);
+        for (auto ref = begin; ref != spheres_end; ++ref) {
+            ordered.add(primitives.spheres.at(ref->index));
+            ref->index = static_cast<uint32_t>(ordered.size() - 1);
+        }
+        auto rects_end = std::stable_partition(spheres_end, end, is_rect);
+        for (auto ref = spheres_end; ref != rects_end; ++ref) {
+            ordered_rects.add(primitives.rects, ref->index);
+            ref->index = static_cast<uint32_t>(ordered_rects.size() - 1);
+        }
+        n.spare = static_cast<uint8_t>((spheres_end - begin) |
+                                       (rects_end - spheres_end) << 4);
+    }
+
+    primitives.spheres = std::move(ordered);
+    primitives.rects = std::move(ordered_rects);
+}
+
+bool primitive_bvh::intersect(const ray& r, double t_min, double t_max,
+                              hit_query& query) const {
+    auto closest_so_far = t_max;
+
+    return traverse_flat_bvh(
+        nodes, r, t_min, closest_so_far,
+        [&](const flat_bvh_node& leaf, double& closest) {
+            bool hit_anything = false;
+            auto spheres = leaf.spare & 0xf;
+            auto rects = leaf.spare >> 4;
+
+            if (spheres > 0 && primitives.spheres.intersect_range(
+                                   primitives.refs[leaf.offset].index, spheres,
+                                   r, t_min, closest, query)) {
+                hit_anything = true;
+                closest = query.t;
+            }
+            if (rects > 0 &&
+                primitives.rects.intersect_range(
+                    primitives.refs[leaf.offset + spheres].index, rects, r,
+                    t_min, closest, query)) {
+                hit_anything = true;
+                closest = query.t;
+            }
+            for (uint32_t i = leaf.offset + spheres + rects;
+                 i < leaf.offset + leaf.count; ++i) {
+                if (primitives.intersect(primitives.refs[i], r, t_min, closest,
+                                         query)) {
+                    hit_anything = true;
+                    closest = query.t;
+                }
+            }
+            return hit_anything;
+        });
+}
+
+#endif
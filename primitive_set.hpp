@@ -0,0 +1,154 @@
+/**
+ * @file primitive_set.hpp
+ * @author @rjkilpatrick
+ * @brief Primitives stored by value, one array per type
+ *
+ * The built-in primitives are a closed set, so rather than calling `hit`
+ * through a `shared_ptr<hittable>` they can be stored by value and reached
+ * with a type tag and an index. Intersecting them is then a switch and a
+ * direct call. Anything else still goes through the virtual `hittable`
+ * interface.
+ *
+ */
+#ifndef PRIMITIVE_SET_H
+#define PRIMITIVE_SET_H
+
+#include "aarect.hpp"
+#include "box.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "moving_sphere.hpp"
+#include "rect_batch.hpp"
+#include "sphere.hpp"
+#include "sphere_batch.hpp"
+#include "utils.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class primitive_type : uint32_t {
+    sphere,
+    moving_sphere,
+    rect, // Any of the axis-aligned rectangles
+    box,
+    other // Any other hittable, called virtually
+};
+
+// Which array a primitive lives in and where
+struct primitive_ref {
+    primitive_ref() : tag(0), index(0) {}
+    primitive_ref(primitive_type t, uint32_t i)
+        : tag(static_cast<uint32_t>(t)), index(i) {}
+
+    primitive_type type() const { return static_cast<primitive_type>(tag); }
+
+    uint32_t tag : 3;
+    uint32_t index : 29;
+};
+
+static_assert(sizeof(primitive_ref) == 4, "primitive_ref should be 4 bytes");
+
+class primitive_set {
+public:
+    primitive_set() {}
+    primitive_set(const hittable_list& list) {
+        for (const auto& object : list.objects) {
+            add(object);
+        }
+    }
+
+    // Copies built-in primitives into their own array
+    void add(const std::shared_ptr<hittable>& object);
+
+    size_t size() const { return refs.size(); }
+
+    inline bool intersect(primitive_ref primitive, const ray& r, double t_min,
+                          double t_max, hit_query& query) const;
+
+    bool bounding_box(primitive_ref primitive, double t0, double t1,
+                      aabb& output_box) const;
+
+public:
+    std::vector<primitive_ref> refs; // Every primitive, in the order added
+    sphere_batch spheres;
+    std::vector<moving_sphere> moving_spheres;
+    rect_batch rects;
+    std::vector<box> boxes;
+    std::vector<std::shared_ptr<hittable>> others;
+
+private:
+    template <typename T>
+    static primitive_ref push(primitive_type type, std::vector<T>& array,
+                              const T& object) {
+        array.push_back(object);
+        return {type, static_cast<uint32_t>(array.size() - 1)};
+    }
+
+    template <typename batch_type, typename T>
+    static primitive_ref push(primitive_type type, batch_type& batch,
+                              const T& object) {
+        batch.add(object);
+        return {type, static_cast<uint32_t>(batch.size() - 1)};
+    }
+};
+
+void primitive_set::add(const std::shared_ptr<hittable>& object) {
+    auto* p = object.get();
+    if (auto s = dynamic_cast<const sphere*>(p)) {
+        refs.push_back(push(primitive_type::sphere, spheres, *s));
+    } else if (auto m = dynamic_cast<const moving_sphere*>(p)) {
+        refs.push_back(push(primitive_type::moving_sphere, moving_spheres, *m));
+    } else if (auto xy = dynamic_cast<const xy_rect*>(p)) {
+        refs.push_back(push(primitive_type::rect, rects, *xy));
+    } else if (auto xz = dynamic_cast<const xz_rect*>(p)) {
+        refs.push_back(push(primitive_type::rect, rects, *xz));
+    } else if (auto yz = dynamic_cast<const yz_rect*>(p)) {
+        refs.push_back(push(primitive_type::rect, rects, *yz));
+    } else if (auto b = dynamic_cast<const box*>(p)) {
+        refs.push_back(push(primitive_type::box, boxes, *b));
+    } else {
+        refs.push_back(push(primitive_type::other, others, object));
+    }
+}
+
+// The qualified calls below are resolved at compile time
+bool primitive_set::intersect(primitive_ref primitive, const ray& r,
+                              double t_min, double t_max,
+                              hit_query& query) const {
+    auto i = primitive.index;
+    switch (primitive.type()) {
+    case primitive_type::sphere:
+        return spheres.intersect_range(i, 1, r, t_min, t_max, query);
+    case primitive_type::moving_sphere:
+        return moving_spheres[i].moving_sphere::intersect(r, t_min, t_max,
+                                                          query);
+    case primitive_type::rect:
+        return rects.intersect_range(i, 1, r, t_min, t_max, query);
+    case primitive_type::box:
+        return boxes[i].box::intersect(r, t_min, t_max, query);
+    case primitive_type::other:
+    default:
+        return others[i]->intersect(r, t_min, t_max, query);
+    }
+}
+
+bool primitive_set::bounding_box(primitive_ref primitive, double t0, double t1,
+                                 aabb& output_box) const {
+    switch (primitive.type()) {
+    case primitive_type::sphere:
+        return spheres.bounding_box(primitive.index, output_box);
+    case primitive_type::moving_sphere:
+        return moving_spheres[primitive.index].bounding_box(t0, t1,
+                                                            output_box);
+    case primitive_type::rect:
+        return rects.bounding_box(primitive.index, output_box);
+    case primitive_type::box:
+        return boxes[primitive.index].bounding_box(t0, t1, output_box);
+    case primitive_type::other:
+    default:
+        return others[primitive.index]->bounding_box(t0, t1, output_box);
+    }
+}
+
+#endif
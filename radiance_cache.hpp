@@ -0,0 +1,218 @@
+/**
+ * @file radiance_cache.hpp
+ * @author @rjkilpatrick
+ * @brief Light arriving at diffuse surfaces, averaged over cells of the
+ * scene, for paths to end into rather than bounce on
+ *
+ * Indirect light across a diffuse surface changes slowly, so a path that
+ * has already made one diffuse bounce can take it from nearby estimates
+ * instead of tracing it. The scene's bounds are cut into cubes, and each
+ * cube holds one cell per way a surface in it can face. Only the cells
+ * paths reach are kept, in a hash table found by linear probing. Each
+ * records the mean of the light that paths leaving solid-colour lambertian
+ * hits in it bring back, weighted as the bounce weights it, so the cell's
+ * mean times a hit's albedo is the light the hit scatters.
+ *
+ * A path ending into a warm cell is biased by however far the cell's mean
+ * is from the light at the hit. For a preview that is the point: most such
+ * paths stop. For a final render, the paths that trace on anyway correct
+ * the cell's mean towards what they found, weighted by how rarely they are
+ * traced, which keeps the estimate unbiased however wrong the cell is.
+ *
+ * Cells are claimed by a compare-and-swap and add atomically, so threads
+ * can share one cache.
+ *
+ */
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "aabb.hpp"
+#include "material.hpp"
+#include "material_table.hpp"
+#include "utils.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class radiance_cache {
+public:
+    radiance_cache() {}
+
+    /**
+     * @param resolution Cubes along the longest side of bounds
+     * @param capacity Cells the table can hold, rounded up to a power of 2
+     */
+    radiance_cache(const aabb& bounds, int resolution = 64,
+                   size_t capacity = 1 << 18);
+
+    bool enabled() const { return !cells.empty(); }
+
+    // Whether the light arriving at hits on a material is cached
+    bool caches(const material_table& materials, const material* mat) const {
+        return enabled() &&
+               materials.kind_of(mat) == material_kind::lambertian;
+    }
+
+    /**
+     * @brief Cell of the surface at p facing normal
+     *
+     * @param claim Whether to add the cell if it is not yet in the table
+     * @return `none` if the cell is not there and could not be added
+     */
+    uint32_t cell(const point3& p, const vec3& normal, bool claim);
+
+    // Cell to look p up in. For previews p moves up to half a cube in each
+    // direction, so the edges between cells blur rather than step, but an
+    // unbiased render wants the cell nearest the hit's own light.
+    uint32_t lookup_cell(const point3& p, const vec3& normal);
+
+    // Mean of the light recorded in a cell, or false if it has had fewer
+    // than `warm_samples`
+    bool lookup(uint32_t cell, colour3& arriving) const;
+
+    void record(uint32_t cell, const colour3& arriving);
+
+public:
+    static constexpr uint32_t none = ~0u;
+
+    // Chance of tracing on past a warm cell rather than ending there
+    double trace_share = 0.25;
+    // Samples a cell needs before paths may end into it
+    uint32_t warm_samples = 16;
+    // Whether paths traced past a warm cell correct its mean, rather than
+    // stand alongside it
+    bool unbiased = false;
+
+private:
+    struct entry {
+        entry() {
+            for (auto& s : sum) {
+                s.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<uint64_t> key{0}; // 0 while free
+        std::atomic<double> sum[3];
+        std::atomic<uint32_t> count{0};
+    };
+
+    // Cubes, face and all, packed with 0 left for free entries
+    uint64_t key_of(const point3& p, const vec3& normal) const;
+
+    point3 origin;
+    double cube_size = 1;
+    int resolution = 0;
+    std::vector<entry> cells;
+};
+
+radiance_cache::radiance_cache(const aabb& bounds, int resolution,
+                               size_t capacity)
+    : origin(bounds.min()), resolution(resolution) {
+    auto extent = bounds.max() - bounds.min();
+    auto longest = std::fmax(extent.x(), std::fmax(extent.y(), extent.z()));
+    cube_size = longest > 0 ? longest / resolution : 1;
+
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    cells = std::vector<entry>(size);
+}
+
+uint64_t radiance_cache::key_of(const point3& p, const vec3& normal) const {
+    // 20 bits per axis, then which of the six axis directions the normal is
+    // closest to
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        auto cube = std::floor((p[axis] - origin[axis]) / cube_size);
+        key |= uint64_t(clamp(cube, 0, resolution)) << (20 * axis);
+    }
+    auto a = abs(normal);
+    int axis = a.x() >= a.y() && a.x() >= a.z() ? 0 : a.y() >= a.z() ? 1 : 2;
+    auto face = 2 * axis + (normal[axis] < 0);
+    return (key | uint64_t(face) << 60) + 1;
+}
+
+uint32_t radiance_cache::cell(const point3& p, const vec3& normal,
+                              bool claim) {
+    auto key = key_of(p, normal);
+
+    // Mixes every bit of the key into the low ones the table is indexed by
+    auto h = key;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    const int max_probes = 32;
+    auto mask = cells.size() - 1;
+    for (int probe = 0; probe < max_probes; ++probe) {
+        auto i = (h + probe) & mask;
+        auto found = cells[i].key.load(std::memory_order_acquire);
+        if (found == key) {
+            return uint32_t(i);
+        }
+        if (found == 0) {
+            if (!claim) {
+                return none;
+            }
+            // Another thread may take the entry first, for this cell or
+            // another
+            if (cells[i].key.compare_exchange_strong(
+                    found, key, std::memory_order_acq_rel) ||
+                found == key) {
+                return uint32_t(i);
+            }
+        }
+    }
+    return none;
+}
+
+uint32_t radiance_cache::lookup_cell(const point3& p, const vec3& normal) {
+    if (unbiased) {
+        return cell(p, normal, false);
+    }
+    auto jitter = cube_size * vec3(random_double() - 0.5,
+                                   random_double() - 0.5,
+                                   random_double() - 0.5);
+    return cell(p + jitter, normal, false);
+}
+
+bool radiance_cache::lookup(uint32_t cell, colour3& arriving) const {
+    if (cell == none) {
+        return false;
+    }
+    const auto& e = cells[cell];
+    auto count = e.count.load(std::memory_order_relaxed);
+    if (count < std::max(warm_samples, 1u)) {
+        return false;
+    }
+    arriving = colour3(e.sum[0].load(std::memory_order_relaxed),
+                       e.sum[1].load(std::memory_order_relaxed),
+                       e.sum[2].load(std::memory_order_relaxed)) /
+               count;
+    return true;
+}
+
+void radiance_cache::record(uint32_t cell, const colour3& arriving) {
+    if (cell == none) {
+        return;
+    }
+    // Skips the rare sample with no finite light rather than spoil the
+    // cell for good
+    for (int k = 0; k < 3; ++k) {
+        if (!std::isfinite(double(arriving[k]))) {
+            return;
+        }
+    }
+    auto& e = cells[cell];
+    for (int k = 0; k < 3; ++k) {
+        atomic_add(e.sum[k], double(arriving[k]));
+    }
+    e.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+#endif
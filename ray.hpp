@@ -29,4 +29,11 @@ private:
     double t; // Time
 };
 
+// Bounds on the origins and directions of a group of rays, such as all the
+// camera rays through one tile of the image
+struct ray_bundle {
+    point3 origin_min, origin_max;
+    vec3 direction_min, direction_max;
+};
+
 #endif
\ No newline at end of file
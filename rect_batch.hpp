@@ -0,0 +1,263 @@
+/**
+ * @file rect_batch.hpp
+ * @author @rjkilpatrick
+ * @brief Axis-aligned rectangles of every orientation stored as a structure
+ * of arrays
+ *
+ * Each rectangle keeps its plane as a unit normal along one axis and its
+ * extent as a box which is unbounded along that axis, so all three
+ * orientations share one test and `simd_width` of them are tested at a time.
+ *
+ */
+#ifndef RECT_BATCH_H
+#define RECT_BATCH_H
+
+#include "aarect.hpp"
+#include "hittable_list.hpp"
+#include "simd.hpp"
+#include "utils.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+class rect_batch : public hittable {
+public:
+    rect_batch() { pad(); }
+
+    /**
+     * @brief Adds a rectangle at `k` along `axis`, covering [u0, u1] and
+     * [v0, v1] along the other two axes in increasing order
+     */
+    void add(int axis, double u0, double u1, double v0, double v1, double k,
+             std::shared_ptr<material> m);
+    void add(const xy_rect& r) { add(2, r.x0, r.x1, r.y0, r.y1, r.k, r.mp); }
+    void add(const xz_rect& r) { add(1, r.x0, r.x1, r.z0, r.z1, r.k, r.mp); }
+    void add(const yz_rect& r) { add(0, r.y0, r.y1, r.z0, r.z1, r.k, r.mp); }
+    // Copies rectangle i of another batch
+    void add(const rect_batch& other, size_t i);
+
+    size_t size() const { return materials.size(); }
+
+    // Nearest hit among the rectangles [first, first + count)
+    bool intersect_range(size_t first, size_t count, const ray& r,
+                         double t_min, double t_max, hit_query& query) const;
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override {
+        return intersect_range(0, size(), r, t_min, t_max, query);
+    }
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
+
+    bool bounding_box(size_t i, aabb& output_box) const;
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override;
+
+    // The in-plane axes of a rectangle facing along `axis`, in the order
+    // the single rectangles give them
+    static int u_axis(int axis) { return axis == 0 ? 1 : 0; }
+    static int v_axis(int axis) { return axis == 2 ? 1 : 2; }
+
+public:
+    // Each array runs simd_width past the last rectangle so whole vectors can
+    // always be loaded. Per axis: normal component and extent
+    std::vector<double> normal[3], lower[3], upper[3];
+    std::vector<double> k;
+    std::vector<uint8_t> axes;
+    std::vector<std::shared_ptr<material>> materials;
+
+private:
+    void pad() {
+        for (int a = 0; a < 3; ++a) {
+            normal[a].resize(size() + simd_width, 0);
+            lower[a].resize(size() + simd_width, 0);
+            upper[a].resize(size() + simd_width, 0);
+        }
+        // NaN planes are never hit
+        k.resize(size() + simd_width, std::numeric_limits<double>::quiet_NaN());
+    }
+};
+
+void rect_batch::add(int axis, double u0, double u1, double v0, double v1,
+                     double plane, std::shared_ptr<material> m) {
+    auto i = size();
+    normal[axis][i] = 1;
+    // Held as `real` would hold them, so a hit `shade` snaps onto the plane
+    // lies exactly on it, as its zero error bound claims
+    k[i] = static_cast<real>(plane);
+    // The hit point always lies within the rectangle along its normal
+    lower[axis][i] = -infinity;
+    upper[axis][i] = infinity;
+    lower[u_axis(axis)][i] = static_cast<real>(u0);
+    upper[u_axis(axis)][i] = static_cast<real>(u1);
+    lower[v_axis(axis)][i] = static_cast<real>(v0);
+    upper[v_axis(axis)][i] = static_cast<real>(v1);
+    axes.push_back(static_cast<uint8_t>(axis));
+    materials.push_back(m);
+    pad();
+}
+
+void rect_batch::add(const rect_batch& other, size_t i) {
+    int axis = other.axes[i];
+    auto u = u_axis(axis);
+    auto v = v_axis(axis);
+    add(axis, other.lower[u][i], other.upper[u][i], other.lower[v][i],
+        other.upper[v][i], other.k[i], other.materials[i]);
+}
+
+bool rect_batch::intersect_range(size_t first, size_t count, const ray& r,
+                                 double t_min, double t_max,
+                                 hit_query& query) const {
+    static const double lane_numbers[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    const auto lanes = vdouble::load(lane_numbers);
+
+    const vdouble origin_x(r.origin().x());
+    const vdouble origin_y(r.origin().y());
+    const vdouble origin_z(r.origin().z());
+    const vdouble direction_x(r.direction().x());
+    const vdouble direction_y(r.direction().y());
+    const vdouble direction_z(r.direction().z());
+    const vdouble lower_t(t_min);
+
+    auto closest_so_far = t_max;
+    size_t closest_rect = 0;
+    bool hit_anything = false;
+
+    for (size_t i = 0; i < count; i += simd_width) {
+        auto j = first + i;
+        auto n_x = vdouble::load(&normal[0][j]);
+        auto n_y = vdouble::load(&normal[1][j]);
+        auto n_z = vdouble::load(&normal[2][j]);
+
+        // Only one component of each normal is non-zero, so these pick out
+        // the ray along that axis exactly
+        auto origin_n = origin_x * n_x + origin_y * n_y + origin_z * n_z;
+        auto direction_n =
+            direction_x * n_x + direction_y * n_y + direction_z * n_z;
+        auto t = (vdouble::load(&k[j]) - origin_n) / direction_n;
+
+        // Lanes past the end of the range belong to other rectangles
+        const vdouble upper_t(closest_so_far);
+        auto valid = (t > lower_t) & (t < upper_t) &
+                     (lanes < vdouble(static_cast<double>(count - i)));
+        if (!any(valid)) {
+            continue;
+        }
+
+        auto x = origin_x + t * direction_x;
+        auto y = origin_y + t * direction_y;
+        auto z = origin_z + t * direction_z;
+        valid = valid & (x >= vdouble::load(&lower[0][j])) &
+                (x <= vdouble::load(&upper[0][j])) &
+                (y >= vdouble::load(&lower[1][j])) &
+                (y <= vdouble::load(&upper[1][j])) &
+                (z >= vdouble::load(&lower[2][j])) &
+                (z <= vdouble::load(&upper[2][j]));
+        if (!any(valid)) {
+            continue;
+        }
+
+        // Reduce over the lanes
+        double ts[simd_width];
+        select(valid, t, vdouble(infinity)).store(ts);
+        for (int l = 0; l < simd_width; ++l) {
+            if (ts[l] < closest_so_far) {
+                closest_so_far = ts[l];
+                closest_rect = j + l;
+                hit_anything = true;
+            }
+        }
+    }
+
+    if (!hit_anything) {
+        return false;
+    }
+
+    query.t = closest_so_far;
+    query.object = this;
+    query.primitive = static_cast<uint32_t>(closest_rect);
+    return true;
+}
+
+void rect_batch::shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const {
+    auto i = query.primitive;
+    int axis = axes[i];
+    auto u = u_axis(axis);
+    auto v = v_axis(axis);
+
+    rec.t = query.t;
+    rec.p = r.at(rec.t);
+    rec.p[axis] = k[i];
+    // Exactly on the plane, where rays leaving it find t = 0 and miss it
+    rec.error_offset = vec3{0, 0, 0};
+    rec.u = (rec.p[u] - lower[u][i]) / (upper[u][i] - lower[u][i]);
+    rec.v = (rec.p[v] - lower[v][i]) / (upper[v][i] - lower[v][i]);
+
+    vec3 outward_normal{0, 0, 0};
+    outward_normal[axis] = 1;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = materials[i].get();
+}
+
+bool rect_batch::bounding_box(size_t i, aabb& output_box) const {
+    // Padded along the normal, as the single rectangles are
+    int axis = axes[i];
+    point3 low(lower[0][i], lower[1][i], lower[2][i]);
+    point3 high(upper[0][i], upper[1][i], upper[2][i]);
+    low[axis] = k[i] - EPSILON;
+    high[axis] = k[i] + EPSILON;
+    output_box = aabb(low, high);
+    return true;
+}
+
+bool rect_batch::bounding_box(double t0, double t1, aabb& output_box) const {
+    if (size() == 0) {
+        return false;
+    }
+    bounding_box(0, output_box);
+    for (size_t i = 1; i < size(); ++i) {
+        aabb box;
+        bounding_box(i, box);
+        output_box = surrounding_box(output_box, box);
+    }
+    return true;
+}
+
+/**
+ * @brief Gathers the axis-aligned rectangles of a list into one batch
+ *
+ * @return hittable_list The batch followed by everything that is not a
+ * rectangle
+ */
+hittable_list batch_rects(const hittable_list& list) {
+    auto batch = std::make_shared<rect_batch>();
+    hittable_list others;
+
+    for (const auto& object : list.objects) {
+        auto* p = object.get();
+        if (auto xy = dynamic_cast<const xy_rect*>(p)) {
+            batch->add(*xy);
+        } else if (auto xz = dynamic_cast<const xz_rect*>(p)) {
+            batch->add(*xz);
+        } else if (auto yz = dynamic_cast<const yz_rect*>(p)) {
+            batch->add(*yz);
+        } else {
+            others.add(object);
+        }
+    }
+
+    if (batch->size() == 0) {
+        return others;
+    }
+    hittable_list batched(batch);
+    batched.objects.insert(batched.objects.end(), others.objects.begin(),
+                           others.objects.end());
+    return batched;
+}
+
+#endif
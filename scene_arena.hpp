@@ -0,0 +1,126 @@
+/**
+ * @file scene_arena.hpp
+ * @author @rjkilpatrick
+ * @brief Pools that hold a scene's primitives, materials and textures
+ *
+ * Objects of each type are packed next to each other in large chunks, and
+ * never move once made. Everything is destroyed and freed together when the
+ * arena goes away.
+ *
+ */
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class scene_arena {
+public:
+    scene_arena() {}
+    ~scene_arena() {
+        // Undo construction, newest first
+        while (!pools.empty()) {
+            pools.pop_back();
+        }
+    }
+
+    scene_arena(const scene_arena&) = delete;
+    scene_arena& operator=(const scene_arena&) = delete;
+
+    /**
+     * @brief Constructs a T in the arena
+     *
+     * @return std::shared_ptr<T> A handle which does not own the object, so
+     * copying it costs no reference counting. The arena must outlive every
+     * handle.
+     */
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        auto* object = pool_for<T>().make(std::forward<Args>(args)...);
+        return std::shared_ptr<T>(std::shared_ptr<void>(), object);
+    }
+
+    // Calls f(T&) on every T made so far, in the order they were made
+    template <typename T, typename function> void for_each(function&& f) {
+        auto id = type_id<T>();
+        if (id >= pool_by_type.size() || pool_by_type[id] == nullptr) {
+            return;
+        }
+        auto& p = *static_cast<pool<T>*>(pool_by_type[id]);
+        for (size_t c = 0; c < p.chunks.size(); ++c) {
+            auto count = c + 1 == p.chunks.size() ? p.used : p.chunk_capacity;
+            for (size_t i = 0; i < count; ++i) {
+                f(p.chunks[c][i]);
+            }
+        }
+    }
+
+private:
+    struct pool_base {
+        virtual ~pool_base() {}
+    };
+
+    template <typename T>
+    struct pool : public pool_base {
+        // Chunks of about 64 KiB
+        static constexpr size_t chunk_capacity =
+            sizeof(T) < (1 << 16) ? (1 << 16) / sizeof(T) : 1;
+
+        template <typename... Args> T* make(Args&&... args) {
+            if (chunks.empty() || used == chunk_capacity) {
+                chunks.push_back(static_cast<T*>(::operator new(
+                    chunk_capacity * sizeof(T), std::align_val_t{alignof(T)})));
+                used = 0;
+            }
+            auto* object =
+                new (chunks.back() + used) T(std::forward<Args>(args)...);
+            ++used;
+            return object;
+        }
+
+        ~pool() {
+            for (size_t c = chunks.size(); c-- > 0;) {
+                auto count = c + 1 == chunks.size() ? used : chunk_capacity;
+                for (size_t i = count; i-- > 0;) {
+                    chunks[c][i].~T();
+                }
+                ::operator delete(chunks[c], std::align_val_t{alignof(T)});
+            }
+        }
+
+        std::vector<T*> chunks;
+        size_t used = 0; // In the last chunk
+    };
+
+    // A small number for each type, handed out as types are first used
+    static size_t next_type_id() {
+        static size_t count = 0;
+        return count++;
+    }
+    template <typename T> static size_t type_id() {
+        static const size_t id = next_type_id();
+        return id;
+    }
+
+    template <typename T> pool<T>& pool_for() {
+        auto id = type_id<T>();
+        if (id >= pool_by_type.size()) {
+            pool_by_type.resize(id + 1, nullptr);
+        }
+        if (pool_by_type[id] == nullptr) {
+            pools.push_back(std::make_unique<pool<T>>());
+            pool_by_type[id] = pools.back().get();
+        }
+        return *static_cast<pool<T>*>(pool_by_type[id]);
+    }
+
+private:
+    std::vector<std::unique_ptr<pool_base>> pools; // In order of creation
+    std::vector<pool_base*> pool_by_type;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/**
+ * @file scene_generator.hpp
+ * @author @rjkilpatrick
+ * @brief Seeded procedural scenes of millions of spheres
+ *
+ * Spheres are written in parallel straight into a `primitive_set`, and a
+ * `primitive_bvh` is built over it, so no sphere is ever its own object on
+ * the heap. Every sphere's random numbers come from hashing the seed with
+ * its index, so a seed gives the same scene however many threads make it.
+ *
+ */
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+
+#include "material.hpp"
+#include "primitive_bvh.hpp"
+#include "primitive_set.hpp"
+#include "scene_arena.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+enum class sphere_layout {
+    uniform,  // Evenly over the whole square
+    clustered // In round clumps, leaving most of the square empty
+};
+
+struct sphere_field_options {
+    size_t count = 1000000;
+    uint64_t seed = 1;
+    sphere_layout layout = sphere_layout::uniform;
+    // Spheres rest on y = 0 within [-half_width, half_width] in x and z
+    double half_width = 500;
+    double min_radius = 0.2;
+    double max_radius = 0.2;
+    // Only for the clustered layout
+    size_t clusters = 1000;
+    double cluster_radius = 10;
+    // Shares of the spheres, the rest are glass
+    double lambertian_share = 0.8;
+    double metal_share = 0.15;
+    // Distinct materials of each kind, shared between the spheres
+    size_t palette_size = 256;
+};
+
+namespace scene_generator_detail {
+
+// SplitMix64's finaliser
+inline uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// The k-th random number in [0, 1) of item i
+inline double uniform(uint64_t seed, uint64_t i, uint64_t k) {
+    return (mix(seed ^ mix(i * 16 + k)) >> 11) * 0x1.0p-53;
+}
+
+struct palette {
+    std::vector<std::shared_ptr<material>> lambertians, metals, glasses;
+};
+
+inline palette make_palette(const sphere_field_options& options,
+                            scene_arena& arena) {
+    // Items past any sphere index, so materials do not share their numbers
+    const uint64_t base = ~0ull / 32;
+    auto seed = options.seed;
+    auto n = std::max<size_t>(1, options.palette_size);
+
+    palette p;
+    for (size_t i = 0; i < n; ++i) {
+        auto r = [&](int k) { return uniform(seed, base + i, k); };
+        colour3 albedo(r(0) * r(1), r(2) * r(3), r(4) * r(5));
+        p.lambertians.push_back(arena.make<lambertian>(albedo));
+        colour3 tint(0.5 + 0.5 * r(6), 0.5 + 0.5 * r(7), 0.5 + 0.5 * r(8));
+        p.metals.push_back(arena.make<metal>(tint, 0.5 * r(9)));
+    }
+    p.glasses.push_back(arena.make<dielectric>(1.5));
+    return p;
+}
+
+// Writes spheres [begin, end) into the batch
+inline void generate_spheres(const sphere_field_options& options,
+                             const palette& p, size_t begin, size_t end,
+                             sphere_batch& spheres) {
+    auto seed = options.seed;
+    for (auto i = begin; i < end; ++i) {
+        auto r = [&](int k) { return uniform(seed, i, k); };
+
+        double x, z;
+        if (options.layout == sphere_layout::clustered) {
+            auto cluster = static_cast<uint64_t>(r(0) * options.clusters);
+            auto c = [&](int k) { return uniform(~seed, cluster, k); };
+            // Uniform over a disc about the cluster's centre
+            auto distance = options.cluster_radius * std::sqrt(r(1));
+            auto angle = 2 * M_PI * r(2);
+            x = (2 * c(0) - 1) * options.half_width +
+                distance * std::cos(angle);
+            z = (2 * c(1) - 1) * options.half_width +
+                distance * std::sin(angle);
+        } else {
+            x = (2 * r(1) - 1) * options.half_width;
+            z = (2 * r(2) - 1) * options.half_width;
+        }
+        auto radius = options.min_radius +
+                      (options.max_radius - options.min_radius) * r(3);
+
+        auto kind = r(4);
+        const auto& choices =
+            kind < options.lambertian_share ? p.lambertians
+            : kind < options.lambertian_share + options.metal_share
+                ? p.metals
+                : p.glasses;
+        auto pick = static_cast<size_t>(r(5) * choices.size());
+
+        spheres.centre_x[i] = x;
+        spheres.centre_y[i] = radius;
+        spheres.centre_z[i] = z;
+        spheres.radius[i] = radius;
+        spheres.materials[i] = choices[std::min(pick, choices.size() - 1)];
+    }
+}
+
+} // namespace scene_generator_detail
+
+/**
+ * @brief Generates a field of spheres and builds a BVH over it
+ *
+ * @param arena Holds the BVH and the materials
+ */
+std::shared_ptr<primitive_bvh>
+generate_sphere_field(const sphere_field_options& options,
+                      scene_arena& arena) {
+    using namespace scene_generator_detail;
+    auto start = std::chrono::steady_clock::now();
+
+    auto p = make_palette(options, arena);
+    primitive_set set;
+    set.spheres.resize(options.count);
+    set.refs.resize(options.count);
+
+    parallel_chunks(options.count, 1 << 16, [&](size_t begin, size_t end) {
+        generate_spheres(options, p, begin, end, set.spheres);
+        for (auto i = begin; i < end; ++i) {
+            set.refs[i] = {primitive_type::sphere, static_cast<uint32_t>(i)};
+        }
+    });
+    std::chrono::duration<double> generate_time =
+        std::chrono::steady_clock::now() - start;
+
+    auto bvh = arena.make<primitive_bvh>(std::move(set), 0.0, 1.0);
+    std::chrono::duration<double> total_time =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Generated " << options.count << " spheres in "
+              << generate_time.count() << " s, and their BVH in "
+              << total_time.count() - generate_time.count() << " s\n";
+    return bvh;
+}
+
+#endif
@@ -0,0 +1,225 @@
+/**
+ * @file simd.hpp
+ * @author @rjkilpatrick
+ * @brief Thin wrapper over the widest double precision vectors available
+ *
+ * `vdouble` holds 8 lanes with AVX-512, 4 with AVX, 2 with SSE2 and falls
+ * back to a single lane otherwise. The width is picked at compile time, so
+ * build with `-march=native` to get the widest one the machine supports.
+ *
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+
+#if defined(__AVX512F__)
+
+struct vmask {
+    __mmask8 m;
+};
+
+struct vdouble {
+    static constexpr int width = 8;
+
+    vdouble() : v(_mm512_setzero_pd()) {}
+    vdouble(double x) : v(_mm512_set1_pd(x)) {}
+    vdouble(__m512d x) : v(x) {}
+
+    static vdouble load(const double* p) { return _mm512_loadu_pd(p); }
+    void store(double* p) const { _mm512_storeu_pd(p, v); }
+
+    __m512d v;
+};
+
+inline vdouble operator+(vdouble a, vdouble b) {
+    return _mm512_add_pd(a.v, b.v);
+}
+inline vdouble operator-(vdouble a, vdouble b) {
+    return _mm512_sub_pd(a.v, b.v);
+}
+inline vdouble operator*(vdouble a, vdouble b) {
+    return _mm512_mul_pd(a.v, b.v);
+}
+inline vdouble operator/(vdouble a, vdouble b) {
+    return _mm512_div_pd(a.v, b.v);
+}
+inline vdouble sqrt(vdouble a) { return _mm512_sqrt_pd(a.v); }
+inline vdouble fmin(vdouble a, vdouble b) { return _mm512_min_pd(a.v, b.v); }
+inline vdouble fmax(vdouble a, vdouble b) { return _mm512_max_pd(a.v, b.v); }
+
+inline vmask operator<(vdouble a, vdouble b) {
+    return {_mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ)};
+}
+inline vmask operator>(vdouble a, vdouble b) {
+    return {_mm512_cmp_pd_mask(a.v, b.v, _CMP_GT_OQ)};
+}
+inline vmask operator<=(vdouble a, vdouble b) {
+    return {_mm512_cmp_pd_mask(a.v, b.v, _CMP_LE_OQ)};
+}
+inline vmask operator>=(vdouble a, vdouble b) {
+    return {_mm512_cmp_pd_mask(a.v, b.v, _CMP_GE_OQ)};
+}
+inline vmask operator&(vmask a, vmask b) {
+    return {static_cast<__mmask8>(a.m & b.m)};
+}
+inline vmask operator|(vmask a, vmask b) {
+    return {static_cast<__mmask8>(a.m | b.m)};
+}
+inline bool any(vmask a) { return a.m != 0; }
+
+// Lanes of a where the mask is set, otherwise lanes of b
+inline vdouble select(vmask m, vdouble a, vdouble b) {
+    return _mm512_mask_blend_pd(m.m, b.v, a.v);
+}
+
+#elif defined(__AVX__)
+
+struct vmask {
+    __m256d m;
+};
+
+struct vdouble {
+    static constexpr int width = 4;
+
+    vdouble() : v(_mm256_setzero_pd()) {}
+    vdouble(double x) : v(_mm256_set1_pd(x)) {}
+    vdouble(__m256d x) : v(x) {}
+
+    static vdouble load(const double* p) { return _mm256_loadu_pd(p); }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+    __m256d v;
+};
+
+inline vdouble operator+(vdouble a, vdouble b) {
+    return _mm256_add_pd(a.v, b.v);
+}
+inline vdouble operator-(vdouble a, vdouble b) {
+    return _mm256_sub_pd(a.v, b.v);
+}
+inline vdouble operator*(vdouble a, vdouble b) {
+    return _mm256_mul_pd(a.v, b.v);
+}
+inline vdouble operator/(vdouble a, vdouble b) {
+    return _mm256_div_pd(a.v, b.v);
+}
+inline vdouble sqrt(vdouble a) { return _mm256_sqrt_pd(a.v); }
+inline vdouble fmin(vdouble a, vdouble b) { return _mm256_min_pd(a.v, b.v); }
+inline vdouble fmax(vdouble a, vdouble b) { return _mm256_max_pd(a.v, b.v); }
+
+inline vmask operator<(vdouble a, vdouble b) {
+    return {_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)};
+}
+inline vmask operator>(vdouble a, vdouble b) {
+    return {_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)};
+}
+inline vmask operator<=(vdouble a, vdouble b) {
+    return {_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)};
+}
+inline vmask operator>=(vdouble a, vdouble b) {
+    return {_mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ)};
+}
+inline vmask operator&(vmask a, vmask b) { return {_mm256_and_pd(a.m, b.m)}; }
+inline vmask operator|(vmask a, vmask b) { return {_mm256_or_pd(a.m, b.m)}; }
+inline bool any(vmask a) { return _mm256_movemask_pd(a.m) != 0; }
+
+// Lanes of a where the mask is set, otherwise lanes of b
+inline vdouble select(vmask m, vdouble a, vdouble b) {
+    return _mm256_blendv_pd(b.v, a.v, m.m);
+}
+
+#elif defined(__SSE2__)
+
+struct vmask {
+    __m128d m;
+};
+
+struct vdouble {
+    static constexpr int width = 2;
+
+    vdouble() : v(_mm_setzero_pd()) {}
+    vdouble(double x) : v(_mm_set1_pd(x)) {}
+    vdouble(__m128d x) : v(x) {}
+
+    static vdouble load(const double* p) { return _mm_loadu_pd(p); }
+    void store(double* p) const { _mm_storeu_pd(p, v); }
+
+    __m128d v;
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return _mm_add_pd(a.v, b.v); }
+inline vdouble operator-(vdouble a, vdouble b) { return _mm_sub_pd(a.v, b.v); }
+inline vdouble operator*(vdouble a, vdouble b) { return _mm_mul_pd(a.v, b.v); }
+inline vdouble operator/(vdouble a, vdouble b) { return _mm_div_pd(a.v, b.v); }
+inline vdouble sqrt(vdouble a) { return _mm_sqrt_pd(a.v); }
+inline vdouble fmin(vdouble a, vdouble b) { return _mm_min_pd(a.v, b.v); }
+inline vdouble fmax(vdouble a, vdouble b) { return _mm_max_pd(a.v, b.v); }
+
+inline vmask operator<(vdouble a, vdouble b) {
+    return {_mm_cmplt_pd(a.v, b.v)};
+}
+inline vmask operator>(vdouble a, vdouble b) {
+    return {_mm_cmpgt_pd(a.v, b.v)};
+}
+inline vmask operator<=(vdouble a, vdouble b) {
+    return {_mm_cmple_pd(a.v, b.v)};
+}
+inline vmask operator>=(vdouble a, vdouble b) {
+    return {_mm_cmpge_pd(a.v, b.v)};
+}
+inline vmask operator&(vmask a, vmask b) { return {_mm_and_pd(a.m, b.m)}; }
+inline vmask operator|(vmask a, vmask b) { return {_mm_or_pd(a.m, b.m)}; }
+inline bool any(vmask a) { return _mm_movemask_pd(a.m) != 0; }
+
+// Lanes of a where the mask is set, otherwise lanes of b
+inline vdouble select(vmask m, vdouble a, vdouble b) {
+    return _mm_or_pd(_mm_and_pd(m.m, a.v), _mm_andnot_pd(m.m, b.v));
+}
+
+#else
+
+struct vmask {
+    bool m;
+};
+
+struct vdouble {
+    static constexpr int width = 1;
+
+    vdouble() : v(0) {}
+    vdouble(double x) : v(x) {}
+
+    static vdouble load(const double* p) { return *p; }
+    void store(double* p) const { *p = v; }
+
+    double v;
+};
+
+inline vdouble operator+(vdouble a, vdouble b) { return a.v + b.v; }
+inline vdouble operator-(vdouble a, vdouble b) { return a.v - b.v; }
+inline vdouble operator*(vdouble a, vdouble b) { return a.v * b.v; }
+inline vdouble operator/(vdouble a, vdouble b) { return a.v / b.v; }
+inline vdouble sqrt(vdouble a) { return std::sqrt(a.v); }
+inline vdouble fmin(vdouble a, vdouble b) { return std::fmin(a.v, b.v); }
+inline vdouble fmax(vdouble a, vdouble b) { return std::fmax(a.v, b.v); }
+
+inline vmask operator<(vdouble a, vdouble b) { return {a.v < b.v}; }
+inline vmask operator>(vdouble a, vdouble b) { return {a.v > b.v}; }
+inline vmask operator<=(vdouble a, vdouble b) { return {a.v <= b.v}; }
+inline vmask operator>=(vdouble a, vdouble b) { return {a.v >= b.v}; }
+inline vmask operator&(vmask a, vmask b) { return {a.m && b.m}; }
+inline vmask operator|(vmask a, vmask b) { return {a.m || b.m}; }
+inline bool any(vmask a) { return a.m; }
+
+// Lanes of a where the mask is set, otherwise lanes of b
+inline vdouble select(vmask m, vdouble a, vdouble b) { return m.m ? a : b; }
+
+#endif
+
+constexpr int simd_width = vdouble::width;
+
+#endif
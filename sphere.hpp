@@ -4,6 +4,9 @@
 #include "hittable.hpp"
 #include "vec3.hpp"
 
+#include <cmath>
+#include <limits>
+
 void get_sphere_uv(const point3& p, double& u, double& v) {
     ///\f$u = \frac{\phi}{2\pi}\f$
     ///\f$v = \frac{\theta}{\pi}\f$
@@ -13,6 +16,42 @@ void get_sphere_uv(const point3& p, double& u, double& v) {
     v = (theta + M_PI_2) / M_PI;
 }
 
+// Fills in rec for a hit at t on the sphere
+inline void set_sphere_hit(const ray& r, double t, const point3& centre,
+                           double radius, const material* m,
+                           hit_record& rec) {
+    rec.t = t;
+
+    // Project the hit back onto the sphere, in double, so its error depends
+    // on the sphere rather than on how far the ray travelled
+    double offset[3];
+    for (int i = 0; i < 3; ++i) {
+        offset[i] = double(r.origin()[i]) + t * r.direction()[i] - centre[i];
+    }
+    auto scale = radius / std::sqrt(offset[0] * offset[0] +
+                                    offset[1] * offset[1] +
+                                    offset[2] * offset[2]);
+    vec3 p_error;
+    for (int i = 0; i < 3; ++i) {
+        offset[i] *= scale;
+        rec.p[i] = static_cast<real>(centre[i] + offset[i]);
+        p_error[i] = static_cast<real>(
+            5 * std::numeric_limits<double>::epsilon() *
+                (std::fabs(centre[i]) + std::fabs(offset[i])) +
+            error_gamma(1) * std::fabs(rec.p[i]));
+    }
+
+    vec3 outward_normal(offset[0] / radius, offset[1] / radius,
+                        offset[2] / radius);
+    rec.set_face_normal(r, outward_normal);
+    rec.set_error(p_error, outward_normal);
+    double u, v;
+    get_sphere_uv(outward_normal, u, v);
+    rec.u = static_cast<real>(u);
+    rec.v = static_cast<real>(v);
+    rec.mat_ptr = m;
+}
+
 class sphere : public hittable {
 public:
     sphere() {}
@@ -20,8 +59,12 @@ public:
     sphere(point3 cen, double r, std::shared_ptr<material> m)
         : centre(cen), radius(r), mat_ptr(m){};
 
-    virtual bool hit(const ray& r, double t_min, double t_max,
-                     hit_record& rec) const override;
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {
+        set_sphere_hit(r, query.t, centre, radius, mat_ptr.get(), rec);
+    }
     virtual bool bounding_box(double t0, double t1,
                               aabb& output_box) const override;
 
@@ -31,12 +74,18 @@ public:
     std::shared_ptr<material> mat_ptr;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max,
-                 hit_record& rec) const {
-    vec3 oc = r.origin() - centre;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
+bool sphere::intersect(const ray& r, double t_min, double t_max,
+                       hit_query& query) const {
+    // Always in double, as float loses too much for big spheres such as the
+    // ground
+    double oc[3], d[3];
+    for (int i = 0; i < 3; ++i) {
+        oc[i] = double(r.origin()[i]) - centre[i];
+        d[i] = r.direction()[i];
+    }
+    auto a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    auto half_b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+    auto c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - radius * radius;
     auto discriminant = half_b * half_b - a * c; // $$b^2 - 4ac$$
 
     if (discriminant >
@@ -45,24 +94,16 @@ bool sphere::hit(const ray& r, double t_min, double t_max,
 
         auto t = (-half_b - root) / a; // Quadratic formula
         if (t < t_max && t > t_min) {
-            rec.t = t;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - centre) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p - centre) / radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            query.t = t;
+            query.object = this;
             return true;
         }
 
         // Ease of understanding chosen over putting it into a function
         t = (-half_b + root) / a;
         if (t < t_max && t > t_min) {
-            rec.t = t;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - centre) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p - centre) / radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            query.t = t;
+            query.object = this;
             return true;
         }
     }
@@ -0,0 +1,207 @@
+/**
+ * @file sphere_batch.hpp
+ * @author @rjkilpatrick
+ * @brief Many spheres stored as a structure of arrays
+ *
+ * One ray is tested against `simd_width` spheres at a time.
+ *
+ */
+#ifndef SPHERE_BATCH_H
+#define SPHERE_BATCH_H
+
+#include "hittable_list.hpp"
+#include "simd.hpp"
+#include "sphere.hpp"
+#include "utils.hpp"
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+class sphere_batch : public hittable {
+public:
+    sphere_batch() { pad(); }
+
+    void add(const point3& centre, double radius,
+             std::shared_ptr<material> m);
+    void add(const sphere& s) { add(s.centre, s.radius, s.mat_ptr); }
+
+    size_t size() const { return materials.size(); }
+    // Makes room for n spheres, which are then written straight into the
+    // arrays
+    void resize(size_t n) {
+        materials.resize(n);
+        pad();
+    }
+    sphere at(size_t i) const {
+        return sphere{point3(centre_x[i], centre_y[i], centre_z[i]),
+                      radius[i], materials[i]};
+    }
+
+    // Nearest hit among the spheres [first, first + count)
+    bool intersect_range(size_t first, size_t count, const ray& r,
+                         double t_min, double t_max, hit_query& query) const;
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override {
+        return intersect_range(0, size(), r, t_min, t_max, query);
+    }
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override {
+        auto i = query.primitive;
+        point3 centre(centre_x[i], centre_y[i], centre_z[i]);
+        set_sphere_hit(r, query.t, centre, radius[i], materials[i].get(),
+                       rec);
+    }
+
+    bool bounding_box(size_t i, aabb& output_box) const {
+        vec3 extent(radius[i], radius[i], radius[i]);
+        point3 centre(centre_x[i], centre_y[i], centre_z[i]);
+        output_box = aabb(centre - extent, centre + extent);
+        return true;
+    }
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override;
+
+public:
+    // Each array runs simd_width past the last sphere so whole vectors can
+    // always be loaded
+    std::vector<double> centre_x, centre_y, centre_z, radius;
+    std::vector<std::shared_ptr<material>> materials;
+
+private:
+    void pad() {
+        // NaN centres never pass the discriminant test
+        auto nan = std::numeric_limits<double>::quiet_NaN();
+        centre_x.resize(size() + simd_width, nan);
+        centre_y.resize(size() + simd_width, nan);
+        centre_z.resize(size() + simd_width, nan);
+        radius.resize(size() + simd_width, 0);
+    }
+};
+
+void sphere_batch::add(const point3& centre, double r,
+                       std::shared_ptr<material> m) {
+    auto i = size();
+    centre_x[i] = centre.x();
+    centre_y[i] = centre.y();
+    centre_z[i] = centre.z();
+    radius[i] = r;
+    materials.push_back(m);
+    pad();
+}
+
+bool sphere_batch::intersect_range(size_t first, size_t count,
+                                   const ray& r, double t_min, double t_max,
+                                   hit_query& query) const {
+    static const double lane_numbers[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    const auto lanes = vdouble::load(lane_numbers);
+
+    const vdouble origin_x(r.origin().x());
+    const vdouble origin_y(r.origin().y());
+    const vdouble origin_z(r.origin().z());
+    const vdouble direction_x(r.direction().x());
+    const vdouble direction_y(r.direction().y());
+    const vdouble direction_z(r.direction().z());
+    const vdouble a(r.direction().length_squared());
+    const vdouble lower(t_min);
+    const vdouble zero(0.0);
+
+    auto closest_so_far = t_max;
+    size_t closest_sphere = 0;
+    bool hit_anything = false;
+
+    for (size_t i = 0; i < count; i += simd_width) {
+        auto j = first + i;
+        auto oc_x = origin_x - vdouble::load(&centre_x[j]);
+        auto oc_y = origin_y - vdouble::load(&centre_y[j]);
+        auto oc_z = origin_z - vdouble::load(&centre_z[j]);
+        auto rad = vdouble::load(&radius[j]);
+
+        auto half_b =
+            oc_x * direction_x + oc_y * direction_y + oc_z * direction_z;
+        auto c = oc_x * oc_x + oc_y * oc_y + oc_z * oc_z - rad * rad;
+        auto discriminant = half_b * half_b - a * c;
+
+        // Lanes past the end of the range belong to other spheres
+        auto valid = (discriminant > zero) &
+                     (lanes < vdouble(static_cast<double>(count - i)));
+        if (!any(valid)) {
+            continue;
+        }
+
+        // Nearer root if it is in range, otherwise the further one
+        const vdouble upper(closest_so_far);
+        auto root = sqrt(discriminant);
+        auto t_near = (zero - half_b - root) / a;
+        auto t_far = (zero - half_b + root) / a;
+        auto t = select((t_near < upper) & (t_near > lower), t_near, t_far);
+        valid = valid & (t < upper) & (t > lower);
+        if (!any(valid)) {
+            continue;
+        }
+
+        // Reduce over the lanes
+        double ts[simd_width];
+        select(valid, t, vdouble(infinity)).store(ts);
+        for (int k = 0; k < simd_width; ++k) {
+            if (ts[k] < closest_so_far) {
+                closest_so_far = ts[k];
+                closest_sphere = j + k;
+                hit_anything = true;
+            }
+        }
+    }
+
+    if (!hit_anything) {
+        return false;
+    }
+
+    query.t = closest_so_far;
+    query.object = this;
+    query.primitive = static_cast<uint32_t>(closest_sphere);
+    return true;
+}
+
+bool sphere_batch::bounding_box(double t0, double t1, aabb& output_box) const {
+    if (size() == 0) {
+        return false;
+    }
+    bounding_box(0, output_box);
+    for (size_t i = 1; i < size(); ++i) {
+        aabb box;
+        bounding_box(i, box);
+        output_box = surrounding_box(output_box, box);
+    }
+    return true;
+}
+
+/**
+ * @brief Gathers the spheres of a list into one batch
+ *
+ * @return hittable_list The batch followed by everything that is not a sphere
+ */
+hittable_list batch_spheres(const hittable_list& list) {
+    auto batch = std::make_shared<sphere_batch>();
+    hittable_list others;
+
+    for (const auto& object : list.objects) {
+        if (auto s = dynamic_cast<const sphere*>(object.get())) {
+            batch->add(*s);
+        } else {
+            others.add(object);
+        }
+    }
+
+    if (batch->size() == 0) {
+        return others;
+    }
+    hittable_list batched(batch);
+    batched.objects.insert(batched.objects.end(), others.objects.begin(),
+                           others.objects.end());
+    return batched;
+}
+
+#endif
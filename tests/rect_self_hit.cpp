@@ -0,0 +1,103 @@
+/**
+ * @file rect_self_hit.cpp
+ * @author @rjkilpatrick
+ * @brief Checks that rays leaving a rectangle never hit it again
+ *
+ * Rectangles, single or batched, snap their hits onto their plane and claim
+ * no error there, so the plane must be held exactly in `real`. Planes at k
+ * such as 0.1, which float cannot hold, show it. Build and run in single
+ * precision from the repository's root:
+ *
+ *     g++ -std=c++17 -O2 -march=native -DRAYTRACER_SINGLE_PRECISION \
+ *         tests/rect_self_hit.cpp -o rect_self_hit && ./rect_self_hit
+ *
+ */
+#include "../aarect.hpp"
+#include "../rect_batch.hpp"
+#include "../utils.hpp"
+#include "../vec3.hpp"
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Fires rays down onto the plane at k facing along axis, and back out of
+// each hit, counting those that find the plane again
+template <typename hit_function, typename again_function>
+int self_hits(int axis, double k, hit_function&& hit, again_function&& again) {
+    int failures = 0;
+    for (int n = 0; n < 16; ++n) {
+        point3 origin(random_double(0.2, 0.8), random_double(0.2, 0.8),
+                      random_double(0.2, 0.8));
+        origin[axis] = k + 1;
+        vec3 direction = 0.2 * random_in_unit_sphere();
+        direction[axis] = -1;
+
+        hit_record rec;
+        if (!hit(ray(origin, direction), rec)) {
+            std::cerr << "Missed the plane at k = " << k << '\n';
+            ++failures;
+            continue;
+        }
+        auto out = direction;
+        out[axis] = 1;
+        ray leaving(offset_ray_origin(rec, out), out);
+        hit_query query;
+        if (again(leaving, query)) {
+            std::cerr << "Axis " << axis << ", k = " << k
+                      << ": hit itself again at t = " << query.t << '\n';
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+int main() {
+    std::shared_ptr<material> none;
+    int failures = 0;
+    for (double k : {0.1, 0.3, 1.7, 554.3}) {
+        std::vector<std::shared_ptr<hittable>> rects{
+            std::make_shared<yz_rect>(0, 1, 0, 1, k, none),
+            std::make_shared<xz_rect>(0, 1, 0, 1, k, none),
+            std::make_shared<xy_rect>(0, 1, 0, 1, k, none)};
+        // Added straight from doubles, as the rectangles' own are rounded
+        rect_batch batch;
+        for (int axis = 0; axis < 3; ++axis) {
+            batch.add(axis, 0, 1, 0, 1, k, none);
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const auto& rect = *rects[axis];
+            failures += self_hits(
+                axis, k,
+                [&](const ray& r, hit_record& rec) {
+                    return rect.hit(r, 0, infinity, rec);
+                },
+                [&](const ray& r, hit_query& query) {
+                    return rect.intersect(r, 0, infinity, query);
+                });
+            failures += self_hits(
+                axis, k,
+                [&](const ray& r, hit_record& rec) {
+                    hit_query query;
+                    if (!batch.intersect_range(axis, 1, r, 0, infinity,
+                                               query)) {
+                        return false;
+                    }
+                    batch.shade(r, query, rec);
+                    return true;
+                },
+                [&](const ray& r, hit_query& query) {
+                    return batch.intersect_range(axis, 1, r, 0, infinity,
+                                                 query);
+                });
+        }
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " rays hit the rectangle they left\n";
+        return 1;
+    }
+    std::cerr << "No ray hit the rectangle it left\n";
+    return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file tile_traversal.hpp
+ * @author @rjkilpatrick
+ * @brief Culls the hierarchy against a whole tile of camera rays at once
+ *
+ * The rays through one tile of the image are bounded by a `ray_bundle` and
+ * tested against boxes with interval arithmetic. Walking down from the root
+ * of a `bvh_node` (or `hittable_list`) hierarchy gives the deepest few nodes
+ * any of those rays can reach, so each camera ray in the tile can start from
+ * them rather than from the root.
+ *
+ */
+#ifndef TILE_TRAVERSAL_H
+#define TILE_TRAVERSAL_H
+
+#include "bvh.hpp"
+#include "hittable_list.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Whether any ray in the bundle can hit the box in front of its origin
+ *
+ * @param t_near Set to a lower bound on where those rays enter the box
+ */
+inline bool bundle_may_hit(const ray_bundle& bundle, const aabb& box,
+                           double& t_near) {
+    auto t_far = infinity;
+    t_near = 0;
+
+    for (int i = 0; i < 3; ++i) {
+        auto d_min = bundle.direction_min[i];
+        auto d_max = bundle.direction_max[i];
+        auto low = box.min()[i] - bundle.origin_max[i];
+        auto high = box.max()[i] - bundle.origin_min[i];
+
+        if (d_min <= 0 && d_max >= 0) {
+            // Rays may run parallel to this slab, so only a box wholly
+            // behind every ray along this axis can be ruled out
+            if ((high < 0 && d_min == 0) || (low > 0 && d_max == 0)) {
+                return false;
+            }
+            continue;
+        }
+
+        // Interval division of [low, high] by [d_min, d_max], which does not
+        // contain zero
+        double q[4] = {low / d_min, low / d_max, high / d_min, high / d_max};
+        t_near = fmax(t_near, *std::min_element(q, q + 4));
+        t_far = fmin(t_far, *std::max_element(q, q + 4));
+        if (t_far < t_near) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Finds where rays in the bundle should start their traversal
+ *
+ * Any node whose box the bundle cannot reach is dropped, and the survivors
+ * are opened up until there would be more than max_entries of them. Objects
+ * without a bounding box are always kept.
+ *
+ * @return hittable_list The entry points, nearest first
+ */
+hittable_list tile_entry_points(const std::shared_ptr<hittable>& root,
+                                const ray_bundle& bundle, double time0,
+                                double time1, size_t max_entries = 8) {
+    using entry = std::pair<double, std::shared_ptr<hittable>>;
+
+    auto reachable = [&](const std::shared_ptr<hittable>& object,
+                         std::vector<entry>& out) {
+        aabb box;
+        auto t_near = 0.0;
+        if (!object->bounding_box(time0, time1, box) ||
+            bundle_may_hit(bundle, box, t_near)) {
+            out.emplace_back(t_near, object);
+        }
+    };
+
+    std::vector<entry> entries;
+    reachable(root, entries);
+
+    bool opened = true;
+    while (opened) {
+        opened = false;
+        std::vector<entry> next;
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto& object = entries[i].second;
+            std::vector<entry> children;
+
+            if (auto node = dynamic_cast<const bvh_node*>(object.get())) {
+                reachable(node->left, children);
+                if (node->right != node->left) {
+                    reachable(node->right, children);
+                }
+            } else if (auto list =
+                           dynamic_cast<const hittable_list*>(object.get())) {
+                if (list->objects.size() > max_entries) {
+                    next.push_back(entries[i]);
+                    continue;
+                }
+                for (const auto& child : list->objects) {
+                    reachable(child, children);
+                }
+            } else {
+                next.push_back(entries[i]);
+                continue;
+            }
+
+            auto remaining = entries.size() - i - 1;
+            if (next.size() + children.size() + remaining > max_entries) {
+                next.push_back(entries[i]);
+                continue;
+            }
+            next.insert(next.end(), children.begin(), children.end());
+            opened = true;
+        }
+
+        entries.swap(next);
+    }
+
+    // Nearest first so early hits narrow the search through the rest
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const entry& a, const entry& b) {
+                         return a.first < b.first;
+                     });
+
+    hittable_list entry_points;
+    for (const auto& e : entries) {
+        entry_points.add(e.second);
+    }
+    return entry_points;
+}
+
+#endif
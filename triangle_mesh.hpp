@@ -0,0 +1,264 @@
+/**
+ * @file triangle_mesh.hpp
+ * @author @rjkilpatrick
+ * @brief Indexed triangle mesh with its own BVH
+ *
+ * Vertex positions, normals and texture co-ordinates are shared between
+ * triangles through an index buffer, and are stored as floats. Triangles
+ * are intersected with the watertight test of Woop, Benthin and Wald,
+ * "Watertight Ray/Triangle Intersection" (2013), so rays cannot slip
+ * through the edges between neighbouring triangles.
+ *
+ */
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "utils.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Per-vertex float attributes, `stride` bytes apart. The data may live
+// outside the mesh, such as in a memory-mapped file, and need not be
+// aligned.
+struct attribute_view {
+    const char* data = nullptr;
+    size_t stride = 0;
+
+    bool empty() const { return data == nullptr; }
+
+    // Component c of vertex i
+    float get(size_t i, int c) const {
+        float x;
+        std::memcpy(&x, data + i * stride + c * sizeof(float), sizeof x);
+        return x;
+    }
+};
+
+// Mesh buffers for the mesh to own
+struct mesh_data {
+    std::vector<float> positions;  // x, y, z per vertex
+    std::vector<float> normals;    // x, y, z per vertex, or empty
+    std::vector<float> uvs;        // u, v per vertex, or empty
+    std::vector<uint32_t> indices; // Three per triangle
+};
+
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh(mesh_data data, std::shared_ptr<material> m);
+
+    // Borrows buffers that storage keeps alive
+    triangle_mesh(attribute_view vertex_positions,
+                  attribute_view vertex_normals, attribute_view vertex_uvs,
+                  const uint32_t* index_buffer, size_t triangles,
+                  std::shared_ptr<const void> storage,
+                  std::shared_ptr<material> m);
+
+    size_t size() const { return triangle_count; }
+
+    virtual bool intersect(const ray& r, double t_min, double t_max,
+                           hit_query& query) const override;
+
+    virtual void shade(const ray& r, const hit_query& query,
+                       hit_record& rec) const override;
+
+    virtual bool bounding_box(double t0, double t1,
+                              aabb& output_box) const override {
+        output_box = nodes.empty() ? aabb() : nodes[0].box;
+        return !nodes.empty();
+    }
+
+    point3 vertex(uint32_t i) const {
+        return point3{positions.get(i, 0), positions.get(i, 1),
+                      positions.get(i, 2)};
+    }
+
+public:
+    static constexpr int max_leaf_size = 4;
+
+    attribute_view positions, normals, uvs;
+    const uint32_t* indices;
+    size_t triangle_count;
+    std::shared_ptr<const void> storage;
+    std::shared_ptr<material> mat_ptr;
+
+    std::vector<flat_bvh_node> nodes;
+    std::vector<uint32_t> leaf_triangles; // Triangle numbers in leaf order
+
+private:
+    void build();
+};
+
+triangle_mesh::triangle_mesh(mesh_data data, std::shared_ptr<material> m)
+    : mat_ptr(m) {
+    auto owned = std::make_shared<mesh_data>(std::move(data));
+    auto view = [](const std::vector<float>& v, size_t components) {
+        return v.empty() ? attribute_view{}
+                         : attribute_view{reinterpret_cast<const char*>(
+                                              v.data()),
+                                          components * sizeof(float)};
+    };
+    positions = view(owned->positions, 3);
+    normals = view(owned->normals, 3);
+    uvs = view(owned->uvs, 2);
+    indices = owned->indices.data();
+    triangle_count = owned->indices.size() / 3;
+    storage = owned;
+    build();
+}
+
+triangle_mesh::triangle_mesh(attribute_view vertex_positions,
+                             attribute_view vertex_normals,
+                             attribute_view vertex_uvs,
+                             const uint32_t* index_buffer, size_t triangles,
+                             std::shared_ptr<const void> storage,
+                             std::shared_ptr<material> m)
+    : positions(vertex_positions), normals(vertex_normals), uvs(vertex_uvs),
+      indices(index_buffer), triangle_count(triangles), storage(storage),
+      mat_ptr(m) {
+    build();
+}
+
+void triangle_mesh::build() {
+    std::vector<aabb> boxes(triangle_count);
+    for (size_t i = 0; i < triangle_count; ++i) {
+        auto p0 = vertex(indices[3 * i]);
+        auto p1 = vertex(indices[3 * i + 1]);
+        auto p2 = vertex(indices[3 * i + 2]);
+        boxes[i] = aabb{fmin(p0, fmin(p1, p2)), fmax(p0, fmax(p1, p2))};
+    }
+    leaf_triangles = build_flat_bvh(std::move(boxes), max_leaf_size, nodes);
+}
+
+bool triangle_mesh::intersect(const ray& r, double t_min, double t_max,
+                              hit_query& query) const {
+    // Shear the triangles into a space where the ray runs along +z, once
+    // per ray
+    const auto& o = r.origin();
+    const auto& d = r.direction();
+    int kz = 0;
+    if (std::fabs(d.y()) > std::fabs(d[kz]))
+        kz = 1;
+    if (std::fabs(d.z()) > std::fabs(d[kz]))
+        kz = 2;
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    if (d[kz] < 0) {
+        std::swap(kx, ky); // Keep the winding
+    }
+    auto shear_x = d[kx] / d[kz];
+    auto shear_y = d[ky] / d[kz];
+    auto shear_z = 1.0 / d[kz];
+
+    uint32_t closest_triangle = 0;
+    double b1 = 0, b2 = 0;
+    auto closest_so_far = t_max;
+
+    bool hit_anything = traverse_flat_bvh(
+        nodes, r, t_min, closest_so_far,
+        [&](const flat_bvh_node& leaf, double& closest) {
+            bool found = false;
+            for (auto i = leaf.offset; i < leaf.offset + leaf.count; ++i) {
+                auto triangle = leaf_triangles[i];
+                auto a = vertex(indices[3 * triangle]) - o;
+                auto b = vertex(indices[3 * triangle + 1]) - o;
+                auto c = vertex(indices[3 * triangle + 2]) - o;
+
+                auto ax = a[kx] - shear_x * a[kz];
+                auto ay = a[ky] - shear_y * a[kz];
+                auto bx = b[kx] - shear_x * b[kz];
+                auto by = b[ky] - shear_y * b[kz];
+                auto cx = c[kx] - shear_x * c[kz];
+                auto cy = c[ky] - shear_y * c[kz];
+
+                // Edge functions, which agree exactly along shared edges
+                auto u = cx * by - cy * bx;
+                auto v = ax * cy - ay * cx;
+                auto w = bx * ay - by * ax;
+                if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) {
+                    continue;
+                }
+                auto determinant = u + v + w;
+                if (determinant == 0) {
+                    continue;
+                }
+
+                auto t = (u * shear_z * a[kz] + v * shear_z * b[kz] +
+                          w * shear_z * c[kz]) /
+                         determinant;
+                if (!(t > t_min && t < closest)) {
+                    continue;
+                }
+
+                closest = t;
+                closest_triangle = triangle;
+                b1 = v / determinant;
+                b2 = w / determinant;
+                found = true;
+            }
+            return found;
+        });
+
+    if (!hit_anything) {
+        return false;
+    }
+
+    query.t = closest_so_far;
+    query.object = this;
+    query.primitive = closest_triangle;
+    query.u = b1;
+    query.v = b2;
+    return true;
+}
+
+void triangle_mesh::shade(const ray& r, const hit_query& query,
+                          hit_record& rec) const {
+    auto i0 = indices[3 * query.primitive];
+    auto i1 = indices[3 * query.primitive + 1];
+    auto i2 = indices[3 * query.primitive + 2];
+    auto b1 = query.u;
+    auto b2 = query.v;
+    auto b0 = 1 - b1 - b2;
+    auto p0 = vertex(i0);
+
+    auto p1 = vertex(i1);
+    auto p2 = vertex(i2);
+
+    rec.t = query.t;
+    rec.p = b0 * p0 + b1 * p1 + b2 * p2;
+    rec.mat_ptr = mat_ptr.get();
+
+    // Which side was hit comes from the winding, the shading normal is then
+    // put on the same side
+    auto geometric_normal = unit_vector(cross(p1 - p0, p2 - p0));
+    rec.set_face_normal(r, geometric_normal);
+    // From the barycentrics the error depends only on the triangle, and is
+    // cleared along the winding's normal whatever the shading normal
+    rec.set_error(
+        error_gamma(7) * (abs(b0 * p0) + abs(b1 * p1) + abs(b2 * p2)),
+        geometric_normal);
+    if (!normals.empty()) {
+        auto normal = [&](int c) {
+            return b0 * normals.get(i0, c) + b1 * normals.get(i1, c) +
+                   b2 * normals.get(i2, c);
+        };
+        auto shading_normal =
+            unit_vector(vec3(normal(0), normal(1), normal(2)));
+        rec.normal = rec.front_face ? shading_normal : -shading_normal;
+    }
+
+    if (!uvs.empty()) {
+        rec.u = b0 * uvs.get(i0, 0) + b1 * uvs.get(i1, 0) + b2 * uvs.get(i2, 0);
+        rec.v = b0 * uvs.get(i0, 1) + b1 * uvs.get(i1, 1) + b2 * uvs.get(i2, 1);
+    } else {
+        rec.u = b1;
+        rec.v = b2;
+    }
+}
+
+#endif
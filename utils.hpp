@@ -1,15 +1,28 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib> // Might not be using this? TODO: Check
 #include <limits>
 #include <memory>
 #include <random>
+#include <thread>
+#include <vector>
 
 // I am electing to not use the `using` statements as I do not know the
 // standard library well enough to assume things
 
+// Precision of vectors, and so of geometry and traversal. Define
+// RAYTRACER_SINGLE_PRECISION to use float, which halves their size.
+#ifdef RAYTRACER_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
 
@@ -24,8 +37,12 @@ inline double radians_to_degrees(double radians) {
 
 // Returns a random double in the interval [0, 1]
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937_64 generator;
+    // Each thread draws its own stream, and the first thread the one a
+    // default generator would
+    static std::atomic<uint64_t> streams{0};
+    thread_local std::mt19937_64 generator(std::mt19937_64::default_seed +
+                                           streams++);
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
     return distribution(generator);
 }
 
@@ -39,6 +56,32 @@ inline int random_int(int min, int max) {
     return static_cast<int>(random_double(min, max + 1));
 }
 
+// Adds to an atomic which other threads may be adding to
+template <typename T> inline void atomic_add(std::atomic<T>& a, T x) {
+    auto old = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + x, std::memory_order_relaxed)) {
+    }
+}
+
+// Runs f(begin, end) over chunks of [0, n), one per core, but none much
+// smaller than grain
+template <typename function>
+void parallel_chunks(size_t n, size_t grain, function&& f) {
+    size_t chunk_count = std::max(1u, std::thread::hardware_concurrency());
+    chunk_count = std::min(chunk_count, n / grain + 1);
+    auto run = [&](size_t chunk) {
+        f(chunk * n / chunk_count, (chunk + 1) * n / chunk_count);
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunk_count; ++i) {
+        workers.emplace_back(run, i);
+    }
+    run(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
 inline double clamp(double x, double min, double max) {
     if (x < min)
         return min;
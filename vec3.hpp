@@ -8,17 +8,17 @@
 class vec3 {
 public:
     vec3() : e{0, 0, 0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    vec3(real e0, real e1, real e2) : e{e0, e1, e2} {}
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    real x() const { return e[0]; }
+    real y() const { return e[1]; }
+    real z() const { return e[2]; }
 
     vec3 operator-() const {
         return vec3(-e[0], -e[1], -e[2]);
     } // Unitary minus
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    real operator[](int i) const { return e[i]; }
+    real& operator[](int i) { return e[i]; }
 
     vec3& operator+=(const vec3& v) {
         // TODO: Implement [Kahan summation
@@ -30,20 +30,20 @@ public:
     }
 
     // Scalar multiplication
-    vec3& operator*=(const double t) {
+    vec3& operator*=(const real t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    vec3& operator/=(const double t) { return *this *= 1 / t; }
+    vec3& operator/=(const real t) { return *this *= 1 / t; }
 
     // Euclidean norm of vector
-    double length() const { return sqrt(length_squared()); }
+    real length() const { return std::sqrt(length_squared()); }
 
     // Computes the dot product with respect to itself, using euclidean norm
-    double length_squared() const {
+    real length_squared() const {
         return ((e[0] * e[0]) + (e[1] * e[1]) + (e[2] * e[2]));
     }
 
@@ -57,7 +57,7 @@ public:
     }
 
 public:
-    double e[3]; // Components of the vector, not to be confused with basis
+    real e[3]; // Components of the vector, not to be confused with basis
 };
 
 // Type aliases for vec3
@@ -90,15 +90,15 @@ inline vec3 operator*(const vec3& u, const vec3& v) {
     return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& u) {
+inline vec3 operator*(real t, const vec3& u) {
     return vec3(t * u.e[0], t * u.e[1], t * u.e[2]);
 }
 
-inline vec3 operator*(const vec3& u, double t) { return t * u; }
+inline vec3 operator*(const vec3& u, real t) { return t * u; }
 
-inline vec3 operator/(vec3 u, double t) { return (1 / t) * u; }
+inline vec3 operator/(vec3 u, real t) { return (1 / t) * u; }
 
-inline double dot(const vec3& u, const vec3& v) {
+inline real dot(const vec3& u, const vec3& v) {
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
@@ -148,20 +148,27 @@ vec3 reflect(const vec3& u, const vec3& n) { return u - (2 * dot(u, n) * n); }
 
 // Refracts about a normal
 vec3 refract(const vec3& incident, const vec3& normal,
-             double eta_i_over_eta_r) {
-    auto cos_theta = fmin(dot(-incident, normal), 1.0);
+             real eta_i_over_eta_r) {
+    auto cos_theta = std::fmin(dot(-incident, normal), real(1));
     vec3 r_out_perp = eta_i_over_eta_r * (incident + cos_theta * normal);
     vec3 r_out_parallel =
-        -sqrt(fabs(1.0 - r_out_perp.length_squared())) * normal;
+        -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * normal;
     return r_out_perp + r_out_parallel;
 }
 
+// Component-wise absolute value
+inline vec3 abs(const vec3& u) {
+    return vec3{std::fabs(u.x()), std::fabs(u.y()), std::fabs(u.z())};
+}
+
 vec3 fmin(const vec3& u, const vec3& v) {
-    return vec3{fmin(u.x(), v.x()), fmin(u.y(), v.y()), fmin(u.z(), v.z())};
+    return vec3{std::fmin(u.x(), v.x()), std::fmin(u.y(), v.y()),
+                std::fmin(u.z(), v.z())};
 }
 
 vec3 fmax(const vec3& u, const vec3& v) {
-    return vec3{fmax(u.x(), v.x()), fmax(u.y(), v.y()), fmax(u.z(), v.z())};
+    return vec3{std::fmax(u.x(), v.x()), std::fmax(u.y(), v.y()),
+                std::fmax(u.z(), v.z())};
 }
 
 #endif
\ No newline at end of file